@@ -0,0 +1,220 @@
+/*
+ * dispatch_bench.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Cost of a Vulkan call through the loader's exported symbol against
+ * the same call through Device_Dispatch, which skips the loader's
+ * trampoline. Needs a Vulkan driver but no window, `make bench` runs
+ * it on lavapipe when that's installed.
+ */
+
+#include "../src/device_dispatch.h"
+
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+const uint32_t ROUNDS = 100;
+/* Calls recorded into one command buffer before it's reset */
+const uint32_t CALLS_PER_ROUND = 10000;
+
+struct Bench_Device
+{
+	VkInstance instance = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	VkCommandPool pool = VK_NULL_HANDLE;
+	VkCommandBuffer cmd = VK_NULL_HANDLE;
+	VkSemaphore timeline = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties properties{};
+
+	void init()
+	{
+		VkApplicationInfo app_info{};
+		app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+		app_info.pApplicationName = "dispatch_bench";
+		app_info.apiVersion = VK_API_VERSION_1_2;
+
+		VkInstanceCreateInfo instance_info{};
+		instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+		instance_info.pApplicationInfo = &app_info;
+		if (vkCreateInstance(&instance_info, nullptr, &this->instance) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create vk instance!");
+		}
+
+		uint32_t device_count = 1;
+		VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+		vkEnumeratePhysicalDevices(this->instance, &device_count, &physical_device);
+		if (physical_device == VK_NULL_HANDLE)
+		{
+			throw std::runtime_error("failed to find GPUs with vulkan support");
+		}
+		vkGetPhysicalDeviceProperties(physical_device, &this->properties);
+
+		uint32_t family_count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, nullptr);
+		std::vector<VkQueueFamilyProperties> families(family_count);
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, families.data());
+		uint32_t family = 0;
+		while (family < family_count && !(families[family].queueFlags & VK_QUEUE_GRAPHICS_BIT)) family++;
+		if (family == family_count)
+		{
+			throw std::runtime_error("no graphics queue");
+		}
+
+		float priority = 1.0f;
+		VkDeviceQueueCreateInfo queue_info{};
+		queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		queue_info.queueFamilyIndex = family;
+		queue_info.queueCount = 1;
+		queue_info.pQueuePriorities = &priority;
+
+		VkPhysicalDeviceVulkan12Features features_12{};
+		features_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		features_12.timelineSemaphore = VK_TRUE;
+
+		VkDeviceCreateInfo device_info{};
+		device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		device_info.pNext = &features_12;
+		device_info.queueCreateInfoCount = 1;
+		device_info.pQueueCreateInfos = &queue_info;
+		if (vkCreateDevice(physical_device, &device_info, nullptr, &this->device) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create logical device");
+		}
+
+		VkCommandPoolCreateInfo pool_info{};
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		pool_info.queueFamilyIndex = family;
+		vkCreateCommandPool(this->device, &pool_info, nullptr, &this->pool);
+
+		VkCommandBufferAllocateInfo alloc_info{};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.commandPool = this->pool;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandBufferCount = 1;
+		vkAllocateCommandBuffers(this->device, &alloc_info, &this->cmd);
+
+		VkSemaphoreTypeCreateInfo type_info{};
+		type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		VkSemaphoreCreateInfo sem_info{};
+		sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		sem_info.pNext = &type_info;
+		vkCreateSemaphore(this->device, &sem_info, nullptr, &this->timeline);
+	}
+
+	void destroy()
+	{
+		vkDestroySemaphore(this->device, this->timeline, nullptr);
+		vkDestroyCommandPool(this->device, this->pool, nullptr);
+		vkDestroyDevice(this->device, nullptr);
+		vkDestroyInstance(this->instance, nullptr);
+	}
+};
+
+/* ns per call of record, which makes CALLS_PER_ROUND calls into an
+ * open command buffer. Only the calls themselves are timed */
+template <typename F>
+static double time_recording(Bench_Device& dev, F record)
+{
+	VkCommandBufferBeginInfo begin_info{};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	/* Round 0 warms up the pool and isn't counted */
+	std::chrono::duration<double, std::nano> total{0};
+	for (uint32_t r = 0; r <= ROUNDS; ++r)
+	{
+		vkBeginCommandBuffer(dev.cmd, &begin_info);
+		auto start = bench_clock::now();
+		record(dev.cmd);
+		if (r > 0) total += bench_clock::now() - start;
+		vkEndCommandBuffer(dev.cmd);
+		vkResetCommandBuffer(dev.cmd, 0);
+	}
+	return total.count() / ((double) ROUNDS * CALLS_PER_ROUND);
+}
+
+template <typename F>
+static double time_calls(F call)
+{
+	auto start = bench_clock::now();
+	for (uint32_t i = 0; i < ROUNDS * CALLS_PER_ROUND; ++i) call();
+	std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+	return elapsed.count() / ((double) ROUNDS * CALLS_PER_ROUND);
+}
+
+static void report(const char* name, double loader_ns, double table_ns)
+{
+	printf("  %-28s loader %6.2f ns  table %6.2f ns  (%+.1f%%)\n", name, loader_ns, table_ns,
+			100.0 * (table_ns - loader_ns) / loader_ns);
+}
+
+int main()
+{
+	Bench_Device dev;
+	Device_Dispatch dispatch;
+	try
+	{
+		dev.init();
+		dispatch.load(dev.device);
+	}
+	catch (const std::exception& e)
+	{
+		fprintf(stderr, "dispatch: %s\n", e.what());
+		return 1;
+	}
+	printf("dispatch: %s, %u calls per case\n", dev.properties.deviceName, ROUNDS * CALLS_PER_ROUND);
+
+	VkViewport viewport{0.0f, 0.0f, 1280.0f, 720.0f, 0.0f, 1.0f};
+	VkRect2D scissor{{0, 0}, {1280, 720}};
+
+	/* Recording state, the cheapest thing a driver can do, so the
+	 * trampoline is the biggest share of it */
+	report("vkCmdSetViewport",
+		time_recording(dev, [&](VkCommandBuffer cmd) {
+			for (uint32_t i = 0; i < CALLS_PER_ROUND; ++i) vkCmdSetViewport(cmd, 0, 1, &viewport);
+		}),
+		time_recording(dev, [&](VkCommandBuffer cmd) {
+			for (uint32_t i = 0; i < CALLS_PER_ROUND; ++i) dispatch.CmdSetViewport(cmd, 0, 1, &viewport);
+		}));
+	report("vkCmdSetScissor",
+		time_recording(dev, [&](VkCommandBuffer cmd) {
+			for (uint32_t i = 0; i < CALLS_PER_ROUND; ++i) vkCmdSetScissor(cmd, 0, 1, &scissor);
+		}),
+		time_recording(dev, [&](VkCommandBuffer cmd) {
+			for (uint32_t i = 0; i < CALLS_PER_ROUND; ++i) dispatch.CmdSetScissor(cmd, 0, 1, &scissor);
+		}));
+
+	/* An execution only barrier, a heavier command for scale */
+	report("vkCmdPipelineBarrier",
+		time_recording(dev, [&](VkCommandBuffer cmd) {
+			for (uint32_t i = 0; i < CALLS_PER_ROUND; ++i)
+			{
+				vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+						0, 0, nullptr, 0, nullptr, 0, nullptr);
+			}
+		}),
+		time_recording(dev, [&](VkCommandBuffer cmd) {
+			for (uint32_t i = 0; i < CALLS_PER_ROUND; ++i)
+			{
+				dispatch.CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+						0, 0, nullptr, 0, nullptr, 0, nullptr);
+			}
+		}));
+
+	/* What Submit_Batcher::completed polls */
+	uint64_t value = 0;
+	report("vkGetSemaphoreCounterValue",
+		time_calls([&] { vkGetSemaphoreCounterValue(dev.device, dev.timeline, &value); }),
+		time_calls([&] { dispatch.GetSemaphoreCounterValue(dev.device, dev.timeline, &value); }));
+
+	dev.destroy();
+	return 0;
+}
@@ -0,0 +1,471 @@
+/*
+ * frame_bench.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Frame throughput regression check. Renders a few scripted scenes
+ * headless for a fixed number of frames each and writes CPU frame
+ * time percentiles, driver host allocations and Vk_Wrapper::init stage
+ * times as JSON. Given a baseline from an earlier run it exits non
+ * zero if any of those got worse by more than the tolerance, or if
+ * the baseline can't be read.
+ *
+ * `make bench` runs it from bin/ (shaders are loaded relative to the
+ * working directory) on lavapipe when it's installed, so the numbers
+ * don't depend on whatever GPU the machine has. `make bench-baseline`
+ * records a new baseline.
+ *
+ * usage: frame_bench [--frames n] [--out file] [--baseline file] [--tolerance fraction]
+ */
+
+#include "../src/vulkan_boilerplate.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+
+using bench_clock = std::chrono::steady_clock;
+
+/* Frames drawn before measuring, long enough for the swap chain,
+ * the deletion queue and the driver's pools to reach steady state */
+const uint32_t WARMUP_FRAMES = 30;
+
+/* Generated meshes, written next to the binary */
+const char* SMALL_MESH_PATH = "frame_bench_small.tmsh";
+const char* LARGE_MESH_PATH = "frame_bench_large.tmsh";
+
+static int8_t snorm8(float v)
+{
+	return (int8_t) std::lround(std::max(-1.0f, std::min(1.0f, v)) * 127.0f);
+}
+
+/* Unit UV sphere as a .tmsh, so the benchmark needs no assets.
+ * No meshlets, nothing here draws them */
+static void write_sphere(const char* path, uint32_t segments, uint32_t rings)
+{
+	const float pi = 3.14159265f;
+	auto align = [](uint64_t offset) {
+		return (offset + MESH_SECTION_ALIGN - 1) & ~(uint64_t) (MESH_SECTION_ALIGN - 1);
+	};
+
+	Mesh_Header header{};
+	header.magic = MESH_MAGIC;
+	header.version = MESH_VERSION;
+	header.vertex_count = (segments + 1) * (rings + 1);
+	header.index_count = segments * rings * 6;
+	header.index_size = header.vertex_count <= 0xffff ? 2 : 4;
+	for (int k = 0; k < 3; ++k)
+	{
+		header.pos_offset[k] = -1.0f;
+		header.pos_scale[k] = 2.0f;
+	}
+	header.radius = 1.0f;
+	header.vertex_offset = align(sizeof(Mesh_Header));
+	header.index_offset = align(header.vertex_offset + header.vertex_count * sizeof(Packed_Vertex));
+	header.meshlet_offset = align(header.index_offset + (uint64_t) header.index_count * header.index_size);
+	header.file_size = header.meshlet_offset;
+
+	std::vector<char> out(header.file_size, 0);
+	memcpy(out.data(), &header, sizeof(header));
+
+	Packed_Vertex* vertex = reinterpret_cast<Packed_Vertex*>(out.data() + header.vertex_offset);
+	for (uint32_t r = 0; r <= rings; ++r)
+	{
+		float theta = pi * r / rings;
+		for (uint32_t s = 0; s <= segments; ++s, ++vertex)
+		{
+			float phi = 2.0f * pi * s / segments;
+			float n[3] = {std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)};
+			for (int k = 0; k < 3; ++k)
+			{
+				vertex->position[k] = (uint16_t) std::lround((n[k] + 1.0f) * 0.5f * 65535.0f);
+			}
+			/* Octahedral encoding, see meshconv */
+			float l1 = std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]);
+			float x = n[0] / l1;
+			float y = n[1] / l1;
+			if (n[2] < 0.0f)
+			{
+				float ox = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+				y = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+				x = ox;
+			}
+			vertex->normal[0] = snorm8(x);
+			vertex->normal[1] = snorm8(y);
+		}
+	}
+
+	char* index_out = out.data() + header.index_offset;
+	uint32_t written = 0;
+	auto put = [&](uint32_t index) {
+		if (header.index_size == 2)
+		{
+			uint16_t short_index = (uint16_t) index;
+			memcpy(index_out + written * 2, &short_index, 2);
+		} else
+		{
+			memcpy(index_out + written * 4, &index, 4);
+		}
+		written++;
+	};
+	for (uint32_t r = 0; r < rings; ++r)
+	{
+		for (uint32_t s = 0; s < segments; ++s)
+		{
+			uint32_t a = r * (segments + 1) + s;
+			uint32_t b = a + segments + 1;
+			put(a); put(a + 1); put(b);
+			put(b); put(a + 1); put(b + 1);
+		}
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	file.write(out.data(), out.size());
+	if (!file)
+	{
+		throw std::runtime_error(std::string("Failed to write ") + path);
+	}
+}
+
+/* setup runs once after init, frame before every draw_frame */
+struct Scene
+{
+	const char* name;
+	std::function<void(Vk_Wrapper&)> setup;
+	std::function<void(Vk_Wrapper&, uint32_t)> frame;
+	/* Vk_Wrapper::extra_pipelines, it has to be set before init */
+	uint32_t extra_pipelines = 0;
+};
+
+struct Scene_Result
+{
+	std::string name;
+	bool gpu_culling = false;
+	std::vector<double> frame_ms;
+	uint64_t init_allocs = 0;
+	uint64_t frame_allocs = 0;
+	std::vector<Init_Stage> init_stages;
+};
+
+static Scene_Result run_scene(const Scene& scene, uint32_t frames)
+{
+	Scene_Result result;
+	result.name = scene.name;
+
+	/* Far too big for the stack */
+	auto vulkan = std::make_unique<Vk_Wrapper>();
+	vulkan->headless = true;
+	vulkan->extra_pipelines = scene.extra_pipelines;
+	vulkan->init();
+	result.init_stages = vulkan->init_stages;
+	result.init_allocs = vulkan->host_alloc.total_allocs();
+	/* Resolution changes would move the numbers around */
+	vulkan->dyn_res.min_scale = 1.0f;
+	vulkan->dyn_res.max_scale = 1.0f;
+
+	if (scene.setup) scene.setup(*vulkan);
+	/* Only known once a scene is loaded */
+	result.gpu_culling = vulkan->gpu_culling_enabled();
+
+	result.frame_ms.reserve(frames);
+	for (uint32_t i = 0; i < WARMUP_FRAMES + frames; ++i)
+	{
+		/* The same scripted motion on every run */
+		vulkan->scene.angle = i * 0.01f;
+		vulkan->scene.offset[0] = 0.25f * std::sin(i * 0.005f);
+		vulkan->scene.offset[1] = 0.0f;
+
+		uint64_t allocs_before = vulkan->host_alloc.total_allocs();
+		auto start = bench_clock::now();
+		if (scene.frame) scene.frame(*vulkan, i);
+		vulkan->draw_frame();
+		std::chrono::duration<double, std::milli> elapsed = bench_clock::now() - start;
+
+		if (i < WARMUP_FRAMES) continue;
+		result.frame_ms.push_back(elapsed.count());
+		result.frame_allocs += vulkan->host_alloc.total_allocs() - allocs_before;
+	}
+
+	vulkan->cleanup();
+	return result;
+}
+
+/* Nearest rank, on sorted samples */
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	size_t rank = (size_t) std::ceil(p * sorted.size());
+	return sorted[rank ? rank - 1 : 0];
+}
+
+static void write_json(std::ostream& out, const std::vector<Scene_Result>& results, uint32_t frames)
+{
+	out << "{\n\t\"frames\": " << frames << ",\n\t\"scenes\": {\n";
+	for (size_t s = 0; s < results.size(); ++s)
+	{
+		const Scene_Result& r = results[s];
+		std::vector<double> sorted = r.frame_ms;
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0.0;
+		for (double ms : sorted) sum += ms;
+		double init_total = 0.0;
+		for (const auto& stage : r.init_stages) init_total += stage.ms;
+
+		out << "\t\t\"" << r.name << "\": {\n";
+		out << "\t\t\t\"gpu_culling\": " << (r.gpu_culling ? "true" : "false") << ",\n";
+		out << "\t\t\t\"frame_ms\": {"
+			<< "\"mean\": " << sum / sorted.size()
+			<< ", \"p50\": " << percentile(sorted, 0.50)
+			<< ", \"p90\": " << percentile(sorted, 0.90)
+			<< ", \"p99\": " << percentile(sorted, 0.99)
+			<< ", \"max\": " << sorted.back() << "},\n";
+		out << "\t\t\t\"host_allocs\": {"
+			<< "\"init\": " << r.init_allocs
+			<< ", \"per_frame\": " << (double) r.frame_allocs / sorted.size() << "},\n";
+		out << "\t\t\t\"init_ms\": {\"total\": " << init_total;
+		for (const auto& stage : r.init_stages)
+		{
+			out << ", \"" << stage.name << "\": " << stage.ms;
+		}
+		out << "}\n\t\t}" << (s + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "\t}\n}\n";
+}
+
+/* Just enough JSON to read our own output back. Every number ends up
+ * in values under its dotted path, e.g. scenes.triangle.frame_ms.p50 */
+struct Json_Flattener
+{
+	const char* p;
+	std::map<std::string, double>& values;
+
+	void skip_space() { while (*this->p && std::isspace((unsigned char) *this->p)) this->p++; }
+
+	std::string string()
+	{
+		std::string s;
+		this->p++;
+		while (*this->p && *this->p != '"')
+		{
+			if (*this->p == '\\' && this->p[1]) this->p++;
+			s += *this->p++;
+		}
+		if (*this->p) this->p++;
+		return s;
+	}
+
+	void value(const std::string& path)
+	{
+		this->skip_space();
+		if (*this->p == '{')
+		{
+			this->p++;
+			this->skip_space();
+			while (*this->p && *this->p != '}')
+			{
+				std::string key = this->string();
+				this->skip_space();
+				if (*this->p++ != ':') throw std::runtime_error("Malformed baseline JSON");
+				this->value(path.empty() ? key : path + "." + key);
+				this->skip_space();
+				if (*this->p == ',') this->p++;
+				this->skip_space();
+			}
+			if (*this->p) this->p++;
+		} else if (*this->p == '"')
+		{
+			this->string();
+		} else if (*this->p == 't' || *this->p == 'f' || *this->p == 'n')
+		{
+			while (std::isalpha((unsigned char) *this->p)) this->p++;
+		} else
+		{
+			char* end;
+			double number = std::strtod(this->p, &end);
+			if (end == this->p) throw std::runtime_error("Malformed baseline JSON");
+			this->values[path] = number;
+			this->p = end;
+		}
+	}
+};
+
+/* What gets compared against the baseline. A metric regresses when
+ * it exceeds baseline * (1 + tolerance) + slack, the slack keeping
+ * tiny values from failing on noise */
+struct Checked_Metric
+{
+	const char* key;
+	double slack;
+};
+
+const Checked_Metric CHECKED_METRICS[] =
+{
+	{"frame_ms.p50", 0.05},
+	{"frame_ms.p90", 0.05},
+	{"frame_ms.p99", 0.1},
+	{"host_allocs.init", 1.0},
+	{"host_allocs.per_frame", 0.5},
+	{"init_ms.total", 1.0},
+};
+
+/* Returns the number of regressions */
+static int compare(const std::map<std::string, double>& baseline, const std::map<std::string, double>& current,
+		double tolerance)
+{
+	int regressions = 0;
+	for (const auto& [path, now] : current)
+	{
+		for (const auto& metric : CHECKED_METRICS)
+		{
+			const std::string suffix = std::string(".") + metric.key;
+			if (path.size() < suffix.size()
+					|| path.compare(path.size() - suffix.size(), suffix.size(), suffix) != 0) continue;
+
+			auto base = baseline.find(path);
+			if (base == baseline.end())
+			{
+				printf("  %-44s %10.3f  (not in baseline)\n", path.c_str(), now);
+				continue;
+			}
+			bool regressed = now > base->second * (1.0 + tolerance) + metric.slack;
+			regressions += regressed;
+			printf("  %-44s %10.3f  baseline %10.3f  %s\n", path.c_str(), now, base->second,
+					regressed ? "REGRESSED" : "ok");
+		}
+	}
+	return regressions;
+}
+
+static std::map<std::string, double> flatten(const std::string& json)
+{
+	std::map<std::string, double> values;
+	Json_Flattener reader{json.c_str(), values};
+	reader.value("");
+	return values;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t frames = 300;
+	std::string out_path = "frame_bench.json";
+	std::string baseline_path;
+	double tolerance = 0.15;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string arg = argv[i];
+		if (arg == "--frames") frames = (uint32_t) std::max(1, std::atoi(argv[i + 1]));
+		else if (arg == "--out") out_path = argv[i + 1];
+		else if (arg == "--baseline") baseline_path = argv[i + 1];
+		else if (arg == "--tolerance") tolerance = std::atof(argv[i + 1]);
+		else
+		{
+			fprintf(stderr, "usage: %s [--frames n] [--out file] [--baseline file] [--tolerance fraction]\n",
+					argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	const uint32_t grid = 100;
+	std::vector<Mesh_Instance> instances;
+	for (uint32_t z = 0; z < grid; ++z)
+	{
+		for (uint32_t x = 0; x < grid; ++x)
+		{
+			Mesh_Instance inst{};
+			inst.position[0] = ((float) x - grid / 2) * 3.0f;
+			inst.position[2] = ((float) z - grid / 2) * 3.0f;
+			inst.scale = 1.0f;
+			instances.push_back(inst);
+		}
+	}
+	Mesh_File small_mesh;
+	Mesh_File large_mesh;
+
+	const Scene scenes[] =
+	{
+		/* The bare frame, fixed costs only */
+		{"triangle", nullptr, nullptr},
+		/* GPU culled field of instances, orbited so the visible set
+		 * keeps changing */
+		{"instances",
+			[&](Vk_Wrapper& vulkan) {
+				vulkan.load_scene(small_mesh, instances);
+				vulkan.camera.z_near = 0.1f;
+				vulkan.camera.z_far = 600.0f;
+			},
+			[](Vk_Wrapper& vulkan, uint32_t i) {
+				Camera& cam = vulkan.camera;
+				cam.eye[0] = 40.0f * std::sin(vulkan.scene.angle);
+				cam.eye[1] = 8.0f;
+				cam.eye[2] = 40.0f * std::cos(vulkan.scene.angle);
+			}},
+		/* A fresh mesh through the staging path every frame, retired
+		 * through the deletion queue */
+		{"uploads", nullptr,
+			[&](Vk_Wrapper& vulkan, uint32_t i) {
+				Gpu_Mesh mesh = vulkan.upload_mesh(large_mesh);
+				vulkan.destroy_mesh(mesh);
+			}},
+		/* Many pipelines, the triangle drawn through 256 pipeline
+		 * variants every frame so binds dominate */
+		{"pipelines", nullptr, nullptr, 256},
+	};
+
+	std::vector<Scene_Result> results;
+	try
+	{
+		write_sphere(SMALL_MESH_PATH, 16, 8);
+		/* ~5MB, enough for every upload to be a real copy */
+		write_sphere(LARGE_MESH_PATH, 512, 256);
+		small_mesh.open(SMALL_MESH_PATH);
+		large_mesh.open(LARGE_MESH_PATH);
+
+		for (const auto& scene : scenes)
+		{
+			results.push_back(run_scene(scene, frames));
+			std::vector<double> sorted = results.back().frame_ms;
+			std::sort(sorted.begin(), sorted.end());
+			printf("frame_bench: %-10s p50 %7.3f ms  p99 %7.3f ms  %.2f allocs/frame\n", scene.name,
+					percentile(sorted, 0.50), percentile(sorted, 0.99),
+					(double) results.back().frame_allocs / sorted.size());
+		}
+	}
+	catch (const std::exception& e)
+	{
+		fprintf(stderr, "frame_bench: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	std::ostringstream json;
+	write_json(json, results, frames);
+	std::ofstream(out_path) << json.str();
+	printf("frame_bench: wrote %s\n", out_path.c_str());
+
+	if (baseline_path.empty()) return EXIT_SUCCESS;
+	/* Asked for one, so not finding it is a failure, not a pass */
+	std::ifstream baseline_file(baseline_path);
+	if (!baseline_file)
+	{
+		fprintf(stderr, "frame_bench: no baseline at %s, record one with `make bench-baseline`\n",
+				baseline_path.c_str());
+		return EXIT_FAILURE;
+	}
+	std::stringstream baseline_json;
+	baseline_json << baseline_file.rdbuf();
+
+	printf("frame_bench: against %s, tolerance %.0f%%\n", baseline_path.c_str(), tolerance * 100.0);
+	int regressions = compare(flatten(baseline_json.str()), flatten(json.str()), tolerance);
+	if (regressions)
+	{
+		printf("frame_bench: %d regression(s)\n", regressions);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/*
+ * frustum_cull_bench.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Frustum_Culler throughput: a field of random spheres around a
+ * camera, culled with every kernel this CPU has, on one thread and
+ * spread over Job_System. Run with `make bench`.
+ */
+
+#include "../src/frustum_cull.h"
+#include "../src/job_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+using bench_clock = std::chrono::steady_clock;
+
+static double ns_since(bench_clock::time_point start, uint64_t count)
+{
+	std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+	return elapsed.count() / count;
+}
+
+/* Column major perspective projection with Vulkan depth, camera at
+ * the origin looking down -z, so view_proj is just the projection */
+static void perspective(float fov_y, float aspect, float near, float far, float* m)
+{
+	float f = 1.0f / std::tan(fov_y * 0.5f);
+	for (int i = 0; i < 16; ++i) m[i] = 0.0f;
+	m[0] = f / aspect;
+	m[5] = -f;
+	m[10] = far / (near - far);
+	m[11] = -1.0f;
+	m[14] = near * far / (near - far);
+}
+
+int main()
+{
+	Job_System jobs;
+	jobs.init();
+
+	float view_proj[16];
+	perspective(1.5708f, 16.0f / 9.0f, 0.1f, 1000.0f, view_proj);
+	Frustum frustum = Frustum::from_view_proj(view_proj);
+	printf("frustum_cull: %u threads\n", jobs.thread_count());
+
+	/* One scene that stays in cache and one that has to stream */
+	const uint32_t scene_sizes[] = {16 * 1024, 1024 * 1024};
+	for (uint32_t object_count : scene_sizes)
+	{
+		const uint32_t rounds = (64 * 1024 * 1024) / object_count;
+
+		/* Objects all around the camera, so only a fraction of
+		 * them land inside the frustum */
+		Frustum_Culler culler;
+		std::mt19937 rng(1);
+		std::uniform_real_distribution<float> pos(-500.0f, 500.0f);
+		std::uniform_real_distribution<float> size(0.1f, 4.0f);
+		for (uint32_t i = 0; i < object_count; ++i)
+		{
+			float center[3] = {pos(rng), pos(rng), pos(rng)};
+			culler.add(center, size(rng));
+		}
+		printf("  %u objects\n", object_count);
+
+		/* Scalar on one thread is the reference, every other kernel
+		 * and threading mode has to find exactly the same objects.
+		 * Parallel output comes back in job order, hence the sort */
+		std::vector<uint32_t> visible;
+		std::vector<uint32_t> reference;
+		std::vector<uint32_t> sorted;
+		Cull_Kernel kernels[] = {CULL_SCALAR, CULL_SSE, CULL_AVX};
+		for (Cull_Kernel kernel : kernels)
+		{
+			if (kernel > best_cull_kernel()) break;
+			culler.kernel = kernel;
+
+			for (int threaded = 0; threaded < 2; ++threaded)
+			{
+				Job_System* pool = threaded ? &jobs : nullptr;
+				uint32_t count = culler.cull(frustum, visible, pool);
+				sorted.assign(visible.begin(), visible.begin() + count);
+				std::sort(sorted.begin(), sorted.end());
+				if (kernel == CULL_SCALAR && !threaded) reference = sorted;
+				if (sorted != reference)
+				{
+					printf("  %s %s disagrees with scalar: %u vs %zu visible\n",
+							cull_kernel_name(kernel), threaded ? "parallel" : "serial",
+							count, reference.size());
+					jobs.shutdown();
+					return 1;
+				}
+
+				auto start = bench_clock::now();
+				for (uint32_t r = 0; r < rounds; ++r)
+				{
+					culler.cull(frustum, visible, pool);
+				}
+				printf("    %-6s %-8s %7.3f ns/object  visible %u, culled %u\n",
+						cull_kernel_name(kernel), threaded ? "parallel" : "serial",
+						ns_since(start, (uint64_t) rounds * object_count),
+						count, object_count - count);
+			}
+		}
+	}
+
+	jobs.shutdown();
+	return 0;
+}
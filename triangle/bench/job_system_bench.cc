@@ -0,0 +1,122 @@
+/*
+ * job_system_bench.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Measures raw scheduling overhead of Job_System: how long it takes
+ * to get an empty job through the scheduler and back, in various
+ * shapes. Run with `make bench`.
+ */
+
+#include "../src/job_system.h"
+
+#include <chrono>
+#include <cstdio>
+
+using bench_clock = std::chrono::steady_clock;
+
+static double ns_since(bench_clock::time_point start, uint64_t count)
+{
+	std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+	return elapsed.count() / count;
+}
+
+int main()
+{
+	Job_System jobs;
+	jobs.init();
+	printf("job_system: %u threads\n", jobs.thread_count());
+
+	const uint32_t rounds = 200;
+	const uint32_t batch = 1000;
+
+	/* Many tiny jobs from the main thread, workers have to steal
+	 * every one of them */
+	{
+		std::atomic<uint32_t> sum{0};
+		auto start = bench_clock::now();
+		for (uint32_t r = 0; r < rounds; ++r)
+		{
+			Job_Counter counter;
+			for (uint32_t i = 0; i < batch; ++i)
+			{
+				jobs.run(&counter, [&sum] { sum.fetch_add(1, std::memory_order_relaxed); });
+			}
+			jobs.wait(&counter);
+		}
+		printf("  spawn+wait          %8.1f ns/job (%u)\n", ns_since(start, rounds * batch), sum.load());
+	}
+
+	/* Fan out, where each job spawns more jobs from a worker */
+	{
+		std::atomic<uint32_t> sum{0};
+		auto start = bench_clock::now();
+		for (uint32_t r = 0; r < rounds; ++r)
+		{
+			Job_Counter counter;
+			for (uint32_t i = 0; i < batch / 10; ++i)
+			{
+				jobs.run(&counter, [&jobs, &counter, &sum] {
+					for (int k = 0; k < 9; ++k)
+					{
+						jobs.run(&counter, [&sum] { sum.fetch_add(1, std::memory_order_relaxed); });
+					}
+					sum.fetch_add(1, std::memory_order_relaxed);
+				});
+			}
+			jobs.wait(&counter);
+		}
+		printf("  nested spawn        %8.1f ns/job (%u)\n", ns_since(start, rounds * batch), sum.load());
+	}
+
+	/* parallel_for over a trivial body, the per-item cost */
+	{
+		std::vector<float> data(1 << 20, 1.0f);
+		auto start = bench_clock::now();
+		for (uint32_t r = 0; r < rounds / 10; ++r)
+		{
+			jobs.parallel_for((uint32_t) data.size(), 4096, [&data](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; ++i) data[i] *= 1.0001f;
+			});
+		}
+		printf("  parallel_for        %8.2f ns/item\n", ns_since(start, (uint64_t) (rounds / 10) * data.size()));
+	}
+
+	/* More jobs in flight than a thread has slots, each slot is
+	 * reused several times per round so any early reuse shows up
+	 * as a wrong sum */
+	{
+		const uint32_t count = JOB_CAPACITY * 2 + 1808;
+		const uint64_t expected = (uint64_t) count * (count - 1) / 2;
+		auto start = bench_clock::now();
+		for (uint32_t r = 0; r < rounds / 10; ++r)
+		{
+			std::atomic<uint64_t> sum{0};
+			jobs.parallel_for(count, 1, [&sum](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; ++i) sum.fetch_add(i, std::memory_order_relaxed);
+			});
+			if (sum.load() != expected)
+			{
+				fprintf(stderr, "job_system: slot reuse sum %llu, expected %llu\n",
+						(unsigned long long) sum.load(), (unsigned long long) expected);
+				jobs.shutdown();
+				return 1;
+			}
+		}
+		printf("  over capacity       %8.1f ns/job (%u)\n", ns_since(start, (uint64_t) (rounds / 10) * count), count);
+	}
+
+	/* What it replaces, a thread per task */
+	{
+		const uint32_t threads = 200;
+		auto start = bench_clock::now();
+		for (uint32_t i = 0; i < threads; ++i)
+		{
+			std::thread([] {}).join();
+		}
+		printf("  std::thread baseline %7.1f ns/task\n", ns_since(start, threads));
+	}
+
+	jobs.shutdown();
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * camera.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * View and projection matrices for Camera, see camera.h
+ */
+
+#include "camera.h"
+#include <cmath>
+
+static void normalize(float* v)
+{
+	float len = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	v[0] /= len; v[1] /= len; v[2] /= len;
+}
+
+static void cross(const float* a, const float* b, float* out)
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float dot(const float* a, const float* b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+void Camera::view_proj(float aspect, float* out) const
+{
+	/* Right handed view, looking down -z with y up */
+	float forward[3] = {
+		this->target[0] - this->eye[0],
+		this->target[1] - this->eye[1],
+		this->target[2] - this->eye[2],
+	};
+	normalize(forward);
+	float up[3] = {0.0f, 1.0f, 0.0f};
+	float side[3];
+	cross(forward, up, side);
+	normalize(side);
+	cross(side, forward, up);
+
+	float view[16] = {
+		side[0], up[0], -forward[0], 0.0f,
+		side[1], up[1], -forward[1], 0.0f,
+		side[2], up[2], -forward[2], 0.0f,
+		-dot(side, this->eye), -dot(up, this->eye), dot(forward, this->eye), 1.0f,
+	};
+
+	/* y is flipped so +y stays up on screen */
+	float f = 1.0f / std::tan(this->fov_y * 0.5f);
+	float proj[16] = {};
+	proj[0] = f / aspect;
+	proj[5] = -f;
+	proj[10] = this->z_far / (this->z_near - this->z_far);
+	proj[11] = -1.0f;
+	proj[14] = this->z_near * this->z_far / (this->z_near - this->z_far);
+
+	for (int c = 0; c < 4; ++c)
+	{
+		for (int r = 0; r < 4; ++r)
+		{
+			float sum = 0.0f;
+			for (int k = 0; k < 4; ++k) sum += proj[k * 4 + r] * view[c * 4 + k];
+			out[c * 4 + r] = sum;
+		}
+	}
+}
@@ -0,0 +1,16 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+/* A look-at perspective camera. Matrices come out column major, the
+ * way GLSL reads them, with Vulkan's y down clip space and 0..1 depth */
+struct Camera
+{
+	float eye[3] = {0.0f, 0.0f, 1.0f};
+	float target[3] = {0.0f, 0.0f, 0.0f};
+	float fov_y = 1.0f;    // Radians
+	float z_near = 0.1f;
+	float z_far = 1000.0f;
+
+	void view_proj(float aspect, float* out) const;
+};
+#endif /* !CAMERA_H */
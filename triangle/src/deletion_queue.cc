@@ -0,0 +1,91 @@
+/*
+ * deletion_queue.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Frame deferred destruction of Vulkan objects, see deletion_queue.h
+ */
+
+#include "deletion_queue.h"
+
+void Deletion_Queue::init(VkDevice device, const VkAllocationCallbacks* allocator)
+{
+	this->device = device;
+	this->allocator = allocator;
+}
+
+void Deletion_Queue::push(Object_Type type, uint64_t handle, uint64_t last_use)
+{
+	if (handle == 0) return;
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	/* Keep the queue sorted so collect() only looks at the front,
+	 * out of order entries are raised to newest, see the header */
+	if (last_use < this->newest) last_use = this->newest;
+	this->newest = last_use;
+	this->queue.push_back({last_use, handle, type});
+}
+
+size_t Deletion_Queue::pending() const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->queue.size();
+}
+
+void Deletion_Queue::collect(uint64_t completed)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		while (!this->queue.empty() && this->queue.front().last_use <= completed)
+		{
+			this->batch.push_back(this->queue.front());
+			this->queue.pop_front();
+		}
+	}
+
+	/* Destroy outside the lock, retiring threads don't wait on the driver */
+	for (const auto& obj : this->batch)
+	{
+		this->destroy(obj);
+	}
+	this->batch.clear();
+}
+
+void Deletion_Queue::flush()
+{
+	this->collect(UINT64_MAX);
+}
+
+void Deletion_Queue::destroy(const Retired& obj)
+{
+	switch (obj.type)
+	{
+		case OBJ_BUFFER:
+			vkDestroyBuffer(this->device, (VkBuffer) obj.handle, this->allocator);
+			break;
+		case OBJ_IMAGE:
+			vkDestroyImage(this->device, (VkImage) obj.handle, this->allocator);
+			break;
+		case OBJ_IMAGE_VIEW:
+			vkDestroyImageView(this->device, (VkImageView) obj.handle, this->allocator);
+			break;
+		case OBJ_MEMORY:
+			vkFreeMemory(this->device, (VkDeviceMemory) obj.handle, this->allocator);
+			break;
+		case OBJ_PIPELINE:
+			vkDestroyPipeline(this->device, (VkPipeline) obj.handle, this->allocator);
+			break;
+		case OBJ_PIPELINE_LAYOUT:
+			vkDestroyPipelineLayout(this->device, (VkPipelineLayout) obj.handle, this->allocator);
+			break;
+		case OBJ_FRAMEBUFFER:
+			vkDestroyFramebuffer(this->device, (VkFramebuffer) obj.handle, this->allocator);
+			break;
+		case OBJ_SAMPLER:
+			vkDestroySampler(this->device, (VkSampler) obj.handle, this->allocator);
+			break;
+		case OBJ_SHADER_MODULE:
+			vkDestroyShaderModule(this->device, (VkShaderModule) obj.handle, this->allocator);
+			break;
+	}
+}
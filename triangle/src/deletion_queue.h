@@ -0,0 +1,73 @@
+#ifndef DELETION_QUEUE_H
+#define DELETION_QUEUE_H
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/* Defers destruction of Vulkan objects until the GPU is done with them.
+ *
+ * Each object is retired with the frame index (or timeline value) of
+ * the last submission that used it. Once Vk_Wrapper knows that point
+ * has completed, everything retired at or before it is destroyed in
+ * one batch, so nothing mid-run ever needs vkDeviceWaitIdle.
+ *
+ * The queue is kept sorted by last_use. An object retired with an
+ * older last_use than one already queued is held back until that
+ * newer point completes, it is never destroyed early, only late. */
+struct Deletion_Queue
+{
+	void init(VkDevice device, const VkAllocationCallbacks* allocator);
+
+	/* Safe from any thread */
+	void retire(VkBuffer buffer, uint64_t last_use)             { this->push(OBJ_BUFFER, (uint64_t) buffer, last_use); }
+	void retire(VkImage image, uint64_t last_use)               { this->push(OBJ_IMAGE, (uint64_t) image, last_use); }
+	void retire(VkImageView view, uint64_t last_use)            { this->push(OBJ_IMAGE_VIEW, (uint64_t) view, last_use); }
+	void retire(VkDeviceMemory memory, uint64_t last_use)       { this->push(OBJ_MEMORY, (uint64_t) memory, last_use); }
+	void retire(VkPipeline pipeline, uint64_t last_use)         { this->push(OBJ_PIPELINE, (uint64_t) pipeline, last_use); }
+	void retire(VkPipelineLayout layout, uint64_t last_use)     { this->push(OBJ_PIPELINE_LAYOUT, (uint64_t) layout, last_use); }
+	void retire(VkFramebuffer framebuffer, uint64_t last_use)   { this->push(OBJ_FRAMEBUFFER, (uint64_t) framebuffer, last_use); }
+	void retire(VkSampler sampler, uint64_t last_use)           { this->push(OBJ_SAMPLER, (uint64_t) sampler, last_use); }
+	void retire(VkShaderModule module, uint64_t last_use)       { this->push(OBJ_SHADER_MODULE, (uint64_t) module, last_use); }
+
+	/* Destroys everything retired at or before completed.
+	 * Render thread only */
+	void collect(uint64_t completed);
+	/* Destroys everything, the device must be idle */
+	void flush();
+
+	size_t pending() const;
+private:
+	enum Object_Type : uint32_t
+	{
+		OBJ_BUFFER,
+		OBJ_IMAGE,
+		OBJ_IMAGE_VIEW,
+		OBJ_MEMORY,
+		OBJ_PIPELINE,
+		OBJ_PIPELINE_LAYOUT,
+		OBJ_FRAMEBUFFER,
+		OBJ_SAMPLER,
+		OBJ_SHADER_MODULE,
+	};
+	struct Retired
+	{
+		uint64_t last_use;
+		uint64_t handle;
+		Object_Type type;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocator = nullptr;
+	mutable std::mutex mutex;
+	std::deque<Retired> queue;
+	/* Scratch for collect(), kept around so it doesn't reallocate */
+	std::vector<Retired> batch;
+	uint64_t newest = 0;
+
+	void push(Object_Type type, uint64_t handle, uint64_t last_use);
+	void destroy(const Retired& obj);
+};
+#endif /* !DELETION_QUEUE_H */
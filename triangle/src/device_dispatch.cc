@@ -0,0 +1,32 @@
+/*
+ * device_dispatch.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Loads the dispatch tables declared in device_dispatch.h
+ */
+
+#include "device_dispatch.h"
+#include <stdexcept>
+
+void Device_Dispatch::load(VkDevice device)
+{
+#define DISPATCH_LOAD(name) \
+	this->name = (PFN_vk##name) vkGetDeviceProcAddr(device, "vk" #name); \
+	if (!this->name) throw std::runtime_error("failed to load device function vk" #name);
+	DEVICE_DISPATCH_FUNCTIONS(DISPATCH_LOAD)
+#undef DISPATCH_LOAD
+
+#define DISPATCH_LOAD(name) \
+	this->name = (PFN_vk##name) vkGetDeviceProcAddr(device, "vk" #name);
+	DEVICE_DISPATCH_SWAPCHAIN_FUNCTIONS(DISPATCH_LOAD)
+#undef DISPATCH_LOAD
+}
+
+void Instance_Dispatch::load(VkInstance instance)
+{
+#define DISPATCH_LOAD(name) \
+	this->name = (PFN_vk##name) vkGetInstanceProcAddr(instance, "vk" #name);
+	INSTANCE_DISPATCH_FUNCTIONS(DISPATCH_LOAD)
+#undef DISPATCH_LOAD
+}
@@ -0,0 +1,75 @@
+#ifndef DEVICE_DISPATCH_H
+#define DEVICE_DISPATCH_H
+#include <vulkan/vulkan.h>
+
+/* Device level entry points on the per frame path. Calls through the
+ * loader's exported vk* symbols go via a trampoline that looks up the
+ * device's dispatch table first; these come straight from the driver
+ * through vkGetDeviceProcAddr and skip it.
+ *
+ * Each X(Name) below becomes a PFN_vkName member called Name, so
+ * vkCmdDraw(cmd, ...) is written dispatch.CmdDraw(cmd, ...). Add an
+ * entry here to move another call over. */
+#define DEVICE_DISPATCH_FUNCTIONS(X) \
+	X(BeginCommandBuffer) \
+	X(EndCommandBuffer) \
+	X(ResetCommandBuffer) \
+	X(CmdBeginRenderPass) \
+	X(CmdEndRenderPass) \
+	X(CmdBindPipeline) \
+	X(CmdBindDescriptorSets) \
+	X(CmdBindVertexBuffers) \
+	X(CmdBindIndexBuffer) \
+	X(CmdPushConstants) \
+	X(CmdSetViewport) \
+	X(CmdSetScissor) \
+	X(CmdDraw) \
+	X(CmdDrawIndexed) \
+	X(CmdDrawIndexedIndirectCount) \
+	X(CmdDispatch) \
+	X(CmdFillBuffer) \
+	X(CmdCopyBuffer) \
+	X(CmdCopyImageToBuffer) \
+	X(CmdBlitImage) \
+	X(CmdPipelineBarrier) \
+	X(CmdResetQueryPool) \
+	X(CmdWriteTimestamp) \
+	X(QueueSubmit) \
+	X(WaitSemaphores) \
+	X(GetSemaphoreCounterValue) \
+	X(GetQueryPoolResults)
+
+/* VK_KHR_swapchain, only there if the device was created with it.
+ * Missing ones stay null, devices without a swap chain (the benches)
+ * still get the rest of the table */
+#define DEVICE_DISPATCH_SWAPCHAIN_FUNCTIONS(X) \
+	X(AcquireNextImageKHR) \
+	X(QueuePresentKHR)
+
+/* Instance level extension entry points, which the loader doesn't
+ * export at all. Missing ones stay null */
+#define INSTANCE_DISPATCH_FUNCTIONS(X) \
+	X(CreateDebugUtilsMessengerEXT) \
+	X(DestroyDebugUtilsMessengerEXT)
+
+struct Device_Dispatch
+{
+#define DISPATCH_MEMBER(name) PFN_vk##name name = nullptr;
+	DEVICE_DISPATCH_FUNCTIONS(DISPATCH_MEMBER)
+	DEVICE_DISPATCH_SWAPCHAIN_FUNCTIONS(DISPATCH_MEMBER)
+#undef DISPATCH_MEMBER
+
+	/* Right after vkCreateDevice. Throws if any core 1.2 entry is
+	 * missing, the swap chain ones are left null instead */
+	void load(VkDevice device);
+};
+
+struct Instance_Dispatch
+{
+#define DISPATCH_MEMBER(name) PFN_vk##name name = nullptr;
+	INSTANCE_DISPATCH_FUNCTIONS(DISPATCH_MEMBER)
+#undef DISPATCH_MEMBER
+
+	void load(VkInstance instance);
+};
+#endif /* !DEVICE_DISPATCH_H */
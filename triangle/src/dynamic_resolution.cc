@@ -0,0 +1,54 @@
+/*
+ * dynamic_resolution.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Frame time -> render scale controller used by Vk_Wrapper::draw_frame
+ */
+
+#include "dynamic_resolution.h"
+#include <algorithm>
+#include <cmath>
+
+void Dynamic_Resolution::update(float gpu_ms)
+{
+	if (gpu_ms <= 0.0f) return;
+
+	/* Smooth out single frame noise, but not so much that
+	 * a real load spike takes a second to show up */
+	if (this->smoothed_ms == 0.0f)
+	{
+		this->smoothed_ms = gpu_ms;
+	} else
+	{
+		this->smoothed_ms = this->smoothed_ms * 0.8f + gpu_ms * 0.2f;
+	}
+
+	/* GPU cost roughly follows pixel count, which is scale squared */
+	float headroom = this->target_ms / this->smoothed_ms;
+	float desired = this->scale * std::sqrt(headroom);
+
+	if (headroom < 1.0f)
+	{
+		/* Over budget, drop straight away */
+		this->scale = desired;
+	} else if (headroom > 1.15f)
+	{
+		/* Comfortably under budget, creep back up so we don't
+		 * oscillate around the target */
+		this->scale += (desired - this->scale) * 0.1f;
+	}
+
+	this->scale = std::clamp(this->scale, this->min_scale, this->max_scale);
+}
+
+VkExtent2D Dynamic_Resolution::scaled_extent(VkExtent2D full) const
+{
+	VkExtent2D extent = {
+		static_cast<uint32_t>(std::lround(full.width * this->scale)),
+		static_cast<uint32_t>(std::lround(full.height * this->scale))
+	};
+	extent.width = std::clamp(extent.width, 1u, full.width);
+	extent.height = std::clamp(extent.height, 1u, full.height);
+	return extent;
+}
@@ -0,0 +1,24 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+#include <vulkan/vulkan.h>
+
+/* Picks the internal render resolution from measured GPU frame time.
+ *
+ * The render target is allocated once at the full swap chain extent
+ * and we only ever draw into the top left corner of it, so changing
+ * the scale never has to reallocate anything. The blit pass at the end
+ * of the frame stretches that corner back over the swap chain image. */
+struct Dynamic_Resolution
+{
+	float target_ms = 1000.0f / 60.0f;
+	float min_scale = 0.5f;
+	float max_scale = 1.0f;
+	float scale = 1.0f;
+
+	/* Feed the GPU time of the last completed frame */
+	void update(float gpu_ms);
+	VkExtent2D scaled_extent(VkExtent2D full) const;
+private:
+	float smoothed_ms = 0.0f;
+};
+#endif /* !DYNAMIC_RESOLUTION_H */
@@ -0,0 +1,239 @@
+/*
+ * frame_capture.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Async readback of rendered frames, see frame_capture.h
+ */
+
+#include "frame_capture.h"
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+void Frame_Capture::add_slot(VkBuffer buffer, VkDeviceMemory memory, void* mapped)
+{
+	if (this->slot_count == CAPTURE_RING_SIZE)
+	{
+		throw std::runtime_error("Capture ring is full!");
+	}
+	Capture_Slot& slot = this->slots[this->slot_count++];
+	slot.buffer = buffer;
+	slot.memory = memory;
+	slot.mapped = mapped;
+}
+
+bool Frame_Capture::format_supported(VkFormat image_fmt)
+{
+	switch (image_fmt)
+	{
+		case VK_FORMAT_R8G8B8A8_UNORM:
+		case VK_FORMAT_R8G8B8A8_SRGB:
+		case VK_FORMAT_B8G8R8A8_UNORM:
+		case VK_FORMAT_B8G8R8A8_SRGB:
+			return true;
+		default:
+			return false;
+	}
+}
+
+void Frame_Capture::start(size_t frames_in_flight, VkFormat image_fmt, const Device_Dispatch* dispatch)
+{
+	this->dispatch = dispatch;
+	this->pending.assign(frames_in_flight, -1);
+	this->image_fmt = image_fmt;
+	this->supported = format_supported(image_fmt);
+	if (!this->supported)
+	{
+		std::cerr << "Swap chain format " << image_fmt << " can't be captured, capture disabled" << std::endl;
+	}
+
+	/* PPM wants RGB, swap chains are usually BGRA */
+	this->swap_red_blue = image_fmt == VK_FORMAT_B8G8R8A8_SRGB
+		|| image_fmt == VK_FORMAT_B8G8R8A8_UNORM;
+
+	this->encoder = std::thread(&Frame_Capture::encoder_loop, this);
+}
+
+/* Device must be idle. Flushes whatever is still pending to disk */
+void Frame_Capture::shutdown(VkDevice device, const VkAllocationCallbacks* allocator)
+{
+	for (size_t i = 0; i < this->pending.size(); ++i)
+	{
+		this->frame_retired(i);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->queue_mutex);
+		this->stopping = true;
+	}
+	this->queue_cv.notify_one();
+	if (this->encoder.joinable()) this->encoder.join();
+
+	for (int i = 0; i < this->slot_count; ++i)
+	{
+		vkUnmapMemory(device, this->slots[i].memory);
+		vkDestroyBuffer(device, this->slots[i].buffer, allocator);
+		vkFreeMemory(device, this->slots[i].memory, allocator);
+	}
+	this->slot_count = 0;
+}
+
+/* Returns a free slot for this frame, or -1 if we're not capturing
+ * or the encoder has fallen behind */
+int Frame_Capture::acquire_slot(size_t frame)
+{
+	if (!this->supported || !this->wants_frame()) return -1;
+	uint64_t frame_number = this->next_frame_number++;
+
+	for (int i = 0; i < this->slot_count; ++i)
+	{
+		uint32_t expected = SLOT_FREE;
+		if (this->slots[i].state.compare_exchange_strong(expected, SLOT_IN_FLIGHT))
+		{
+			this->slots[i].frame_number = frame_number;
+			this->pending[frame] = i;
+			this->single_shot = false;
+			return i;
+		}
+	}
+
+	this->dropped++;
+	return -1;
+}
+
+/* image must already be in TRANSFER_SRC_OPTIMAL */
+void Frame_Capture::record_copy(VkCommandBuffer cmd, int slot, VkImage image, VkExtent2D extent)
+{
+	this->slots[slot].extent = extent;
+
+	VkBufferImageCopy region{};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0; // Tightly packed
+	region.bufferImageHeight = 0;
+	region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+	region.imageOffset = {0, 0, 0};
+	region.imageExtent = {extent.width, extent.height, 1};
+
+	this->dispatch->CmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			this->slots[slot].buffer, 1, &region);
+
+	/* Make the transfer visible to host reads once the frame completes */
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = this->slots[slot].buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	this->dispatch->CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+			0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+/* Called once this frame in flight has been waited on,
+ * anything it copied is now safe to read on the host */
+void Frame_Capture::frame_retired(size_t frame)
+{
+	if (frame >= this->pending.size() || this->pending[frame] < 0) return;
+
+	int slot = this->pending[frame];
+	this->pending[frame] = -1;
+	this->slots[slot].state.store(SLOT_ENCODING);
+
+	{
+		std::lock_guard<std::mutex> lock(this->queue_mutex);
+		this->encode_queue.push_back(slot);
+	}
+	this->queue_cv.notify_one();
+}
+
+void Frame_Capture::encoder_loop()
+{
+	FILE* raw_stream = nullptr;
+
+	for (;;)
+	{
+		int slot;
+		{
+			std::unique_lock<std::mutex> lock(this->queue_mutex);
+			this->queue_cv.wait(lock, [this] {
+				return this->stopping || !this->encode_queue.empty();
+			});
+			/* Drain everything before honouring a stop */
+			if (this->encode_queue.empty()) break;
+			slot = this->encode_queue.front();
+			this->encode_queue.pop_front();
+		}
+
+		this->write_slot(this->slots[slot], raw_stream);
+		this->slots[slot].state.store(SLOT_FREE);
+	}
+
+	if (raw_stream) fclose(raw_stream);
+}
+
+void Frame_Capture::write_slot(Capture_Slot& slot, FILE*& raw_stream)
+{
+	const uint8_t* pixels = static_cast<const uint8_t*>(slot.mapped);
+	size_t pixel_count = (size_t) slot.extent.width * slot.extent.height;
+
+	if (this->format == Capture_Format::RAW)
+	{
+		if (!raw_stream)
+		{
+			raw_stream = fopen((this->output_dir + "/capture.raw").c_str(), "wb");
+			if (!raw_stream)
+			{
+				std::cerr << "Failed to open capture stream" << std::endl;
+				return;
+			}
+			Raw_Capture_Header header{};
+			header.magic = CAPTURE_RAW_MAGIC;
+			header.version = CAPTURE_RAW_VERSION;
+			header.width = slot.extent.width;
+			header.height = slot.extent.height;
+			header.vk_format = (uint32_t) this->image_fmt;
+			header.bytes_per_pixel = CAPTURE_BYTES_PER_PIXEL;
+			fwrite(&header, sizeof(header), 1, raw_stream);
+			this->raw_extent = slot.extent;
+		}
+		/* The header only describes one size, the swap chain never
+		 * changes size today but don't write garbage if it does */
+		if (slot.extent.width != this->raw_extent.width || slot.extent.height != this->raw_extent.height)
+		{
+			std::cerr << "Capture size changed mid stream, frame skipped" << std::endl;
+			return;
+		}
+		fwrite(pixels, CAPTURE_BYTES_PER_PIXEL, pixel_count, raw_stream);
+		this->written++;
+		return;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "/frame_%06lu.ppm", (unsigned long) slot.frame_number);
+	FILE* file = fopen((this->output_dir + name).c_str(), "wb");
+	if (!file)
+	{
+		std::cerr << "Failed to open " << this->output_dir << name << std::endl;
+		return;
+	}
+
+	/* Strip alpha and reorder into RGB */
+	std::vector<uint8_t> rgb(pixel_count * 3);
+	int r = this->swap_red_blue ? 2 : 0;
+	int b = this->swap_red_blue ? 0 : 2;
+	for (size_t i = 0; i < pixel_count; ++i)
+	{
+		const uint8_t* pixel = pixels + i * CAPTURE_BYTES_PER_PIXEL;
+		rgb[i * 3 + 0] = pixel[r];
+		rgb[i * 3 + 1] = pixel[1];
+		rgb[i * 3 + 2] = pixel[b];
+	}
+
+	fprintf(file, "P6\n%u %u\n255\n", slot.extent.width, slot.extent.height);
+	fwrite(rgb.data(), 1, rgb.size(), file);
+	fclose(file);
+	this->written++;
+}
@@ -0,0 +1,112 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+#include <vulkan/vulkan.h>
+#include "device_dispatch.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdio>
+
+const int CAPTURE_RING_SIZE = 4;
+/* Readback buffers hold tightly packed 8 bit RGBA or BGRA */
+const uint32_t CAPTURE_BYTES_PER_PIXEL = 4;
+
+/* Start of capture.raw, followed by every captured frame back to
+ * back, each width * height * bytes_per_pixel bytes */
+const uint32_t CAPTURE_RAW_MAGIC = 0x57415254; // "TRAW"
+const uint32_t CAPTURE_RAW_VERSION = 1;
+struct Raw_Capture_Header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t vk_format;        // VkFormat of the pixels, channel order included
+	uint32_t bytes_per_pixel;
+};
+
+enum class Capture_Format
+{
+	PPM, // One numbered .ppm per frame
+	RAW, // Every frame appended to a single capture.raw
+};
+
+/* Ring of host visible buffers that rendered frames get copied
+ * into, so they can be written out without ever stalling the GPU.
+ *
+ * The render thread only records a vkCmdCopyImageToBuffer. Once the
+ * frame has been waited on (which draw_frame does anyway) the
+ * slot is handed to the encoder thread, which writes it to disk and
+ * frees it again. If every slot is busy the frame is dropped rather
+ * than waiting on anything. */
+struct Frame_Capture
+{
+	std::string output_dir = ".";
+	Capture_Format format = Capture_Format::PPM;
+
+	/* Only 8 bit, 4 channel swap chain formats can be captured. For
+	 * anything else capture stays off and acquire_slot never hands
+	 * out a slot */
+	static bool format_supported(VkFormat image_fmt);
+
+	/* Slots are created by Vk_Wrapper since it owns buffer creation */
+	void add_slot(VkBuffer buffer, VkDeviceMemory memory, void* mapped);
+	void start(size_t frames_in_flight, VkFormat image_fmt, const Device_Dispatch* dispatch);
+	void shutdown(VkDevice device, const VkAllocationCallbacks* allocator);
+
+	void capture_next() { this->single_shot = true; }
+	void set_continuous(bool on) { this->continuous = on; }
+	bool wants_frame() const { return this->continuous || this->single_shot; }
+
+	/* Render thread side */
+	int acquire_slot(size_t frame);
+	void record_copy(VkCommandBuffer cmd, int slot, VkImage image, VkExtent2D extent);
+	void frame_retired(size_t frame);
+
+	uint64_t frames_written() const { return this->written.load(); }
+	uint64_t frames_dropped() const { return this->dropped; }
+private:
+	enum Slot_State : uint32_t { SLOT_FREE, SLOT_IN_FLIGHT, SLOT_ENCODING };
+	struct Capture_Slot
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void* mapped = nullptr;
+		VkExtent2D extent = {0, 0};
+		uint64_t frame_number = 0;
+		std::atomic<uint32_t> state{SLOT_FREE};
+	};
+
+	const Device_Dispatch* dispatch = nullptr;
+	Capture_Slot slots[CAPTURE_RING_SIZE];
+	int slot_count = 0;
+	/* Slot recorded by each frame in flight, -1 if none */
+	std::vector<int> pending;
+	bool continuous = false;
+	bool single_shot = false;
+	bool supported = false;
+	bool swap_red_blue = false;
+	VkFormat image_fmt = VK_FORMAT_UNDEFINED;
+	/* Size written in the raw stream's header, encoder thread only */
+	VkExtent2D raw_extent = {0, 0};
+	uint64_t next_frame_number = 0;
+	uint64_t dropped = 0;
+	std::atomic<uint64_t> written{0};
+
+	/* Encoder thread */
+	std::thread encoder;
+	std::mutex queue_mutex;
+	std::condition_variable queue_cv;
+	std::deque<int> encode_queue;
+	bool stopping = false;
+
+	void encoder_loop();
+	void write_slot(Capture_Slot& slot, FILE*& raw_stream);
+};
+#endif /* !FRAME_CAPTURE_H */
@@ -0,0 +1,60 @@
+/*
+ * frame_limiter.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Hybrid sleep/spin frame limiter, see frame_limiter.h
+ */
+
+#include "frame_limiter.h"
+#include <algorithm>
+#include <thread>
+
+void Frame_Limiter::set_target_fps(double fps)
+{
+	this->target_fps = fps;
+	this->reset();
+}
+
+void Frame_Limiter::wait()
+{
+	if (this->target_fps <= 0.0) return;
+
+	auto frame_time = std::chrono::duration_cast<clock::duration>(
+			std::chrono::duration<double>(1.0 / this->target_fps));
+	auto now = clock::now();
+
+	/* First frame, or we fell more than a frame behind. Don't try to
+	 * catch up by running frames back to back, just restart the cadence */
+	if (this->next_deadline == clock::time_point{} || now - this->next_deadline > frame_time)
+	{
+		this->next_deadline = now + frame_time;
+	}
+
+	auto sleep_until = this->next_deadline - this->spin_margin;
+	if (now < sleep_until)
+	{
+		std::this_thread::sleep_until(sleep_until);
+
+		/* Learn how late the OS actually woke us. Grow quickly, shrink
+		 * slowly, never below SPIN_MARGIN_MIN */
+		auto overshoot = clock::now() - sleep_until;
+		auto margin = this->spin_margin;
+		if (overshoot > margin)
+		{
+			margin = std::chrono::duration_cast<std::chrono::nanoseconds>(overshoot) * 5 / 4;
+		} else
+		{
+			margin = margin * 15 / 16 + std::chrono::duration_cast<std::chrono::nanoseconds>(overshoot) / 16;
+		}
+		this->spin_margin = std::clamp<std::chrono::nanoseconds>(margin,
+				SPIN_MARGIN_MIN, SPIN_MARGIN_MAX);
+	}
+
+	while (clock::now() < this->next_deadline)
+	{
+		std::this_thread::yield();
+	}
+
+	this->next_deadline += frame_time;
+}
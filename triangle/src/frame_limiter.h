@@ -0,0 +1,32 @@
+#ifndef FRAME_LIMITER_H
+#define FRAME_LIMITER_H
+#include <chrono>
+
+/* Caps the frame rate without burning a core.
+ *
+ * The OS sleep is only good to a millisecond or so, so we sleep
+ * until just short of the deadline and spin the rest of the way.
+ * The spin window tracks how late sleeps have actually been waking
+ * up, so on a quiet system it shrinks down to SPIN_MARGIN_MIN, which
+ * is kept for scheduler noise. */
+struct Frame_Limiter
+{
+	using clock = std::chrono::steady_clock;
+
+	static constexpr std::chrono::microseconds SPIN_MARGIN_MIN{200};
+	static constexpr std::chrono::microseconds SPIN_MARGIN_MAX{4000};
+
+	/* 0 disables the limiter */
+	double target_fps = 0.0;
+
+	void set_target_fps(double fps);
+	/* Call once per frame, after presenting */
+	void wait();
+	/* Forget the previous deadline, e.g. after sitting idle */
+	void reset() { this->next_deadline = clock::time_point{}; }
+private:
+	clock::time_point next_deadline{};
+	/* Running estimate of sleep overshoot, starts pessimistic */
+	std::chrono::nanoseconds spin_margin = std::chrono::microseconds(2000);
+};
+#endif /* !FRAME_LIMITER_H */
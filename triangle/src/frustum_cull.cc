@@ -0,0 +1,279 @@
+/*
+ * frustum_cull.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * SoA sphere/frustum culling, see frustum_cull.h
+ */
+
+#include "frustum_cull.h"
+#include "job_system.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define CULL_X86 1
+	#include <immintrin.h>
+#endif
+
+/* AVX is picked at runtime, so the AVX kernel is compiled for it on
+ * its own rather than building everything with -mavx */
+#if defined(CULL_X86) && defined(__GNUC__)
+	#define CULL_HAS_AVX 1
+	#define CULL_TARGET_AVX __attribute__((target("avx")))
+#endif
+
+/* Widest vector any kernel loads, the arrays are padded to this */
+const uint32_t CULL_LANES = 8;
+
+static uint32_t pad_lanes(uint32_t count)
+{
+	return (count + CULL_LANES - 1) & ~(CULL_LANES - 1);
+}
+
+static void set_plane(float* plane, float a, float b, float c, float d)
+{
+	/* Normalized so plane distances are in world units and can be
+	 * compared against the radius */
+	float len = std::sqrt(a * a + b * b + c * c);
+	plane[0] = a / len;
+	plane[1] = b / len;
+	plane[2] = c / len;
+	plane[3] = d / len;
+}
+
+Frustum Frustum::from_view_proj(const float* m)
+{
+	/* Row i of a column major matrix */
+	auto r = [m](int i, int j) { return m[j * 4 + i]; };
+
+	Frustum f;
+	set_plane(f.planes[0], r(3, 0) + r(0, 0), r(3, 1) + r(0, 1), r(3, 2) + r(0, 2), r(3, 3) + r(0, 3)); // left
+	set_plane(f.planes[1], r(3, 0) - r(0, 0), r(3, 1) - r(0, 1), r(3, 2) - r(0, 2), r(3, 3) - r(0, 3)); // right
+	set_plane(f.planes[2], r(3, 0) + r(1, 0), r(3, 1) + r(1, 1), r(3, 2) + r(1, 2), r(3, 3) + r(1, 3)); // bottom
+	set_plane(f.planes[3], r(3, 0) - r(1, 0), r(3, 1) - r(1, 1), r(3, 2) - r(1, 2), r(3, 3) - r(1, 3)); // top
+	set_plane(f.planes[4], r(2, 0), r(2, 1), r(2, 2), r(2, 3));                                         // near
+	set_plane(f.planes[5], r(3, 0) - r(2, 0), r(3, 1) - r(2, 1), r(3, 2) - r(2, 2), r(3, 3) - r(2, 3)); // far
+	return f;
+}
+
+Cull_Kernel best_cull_kernel()
+{
+#if defined(CULL_HAS_AVX)
+	if (__builtin_cpu_supports("avx")) return CULL_AVX;
+#endif
+#if defined(CULL_X86)
+	return CULL_SSE;
+#else
+	return CULL_SCALAR;
+#endif
+}
+
+const char* cull_kernel_name(Cull_Kernel kernel)
+{
+	switch (kernel)
+	{
+		case CULL_AVX: return "avx";
+		case CULL_SSE: return "sse";
+		default: return "scalar";
+	}
+}
+
+/* Kernels. Each tests spheres [begin, end) and writes the indices of
+ * the visible ones to out, returning how many it wrote. The SIMD ones
+ * may read up to the next multiple of their width, which the padding
+ * makes safe and which can never produce a visible object */
+static uint32_t cull_scalar(const Frustum& f, const float* x, const float* y, const float* z,
+		const float* r, uint32_t begin, uint32_t end, uint32_t* out)
+{
+	uint32_t written = 0;
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6; ++p)
+		{
+			const float* pl = f.planes[p];
+			float dist = pl[0] * x[i] + pl[1] * y[i] + pl[2] * z[i] + pl[3];
+			inside &= dist >= -r[i];
+		}
+		out[written] = i;
+		written += inside;
+	}
+	return written;
+}
+
+#if defined(CULL_X86)
+static uint32_t cull_sse(const Frustum& f, const float* x, const float* y, const float* z,
+		const float* r, uint32_t begin, uint32_t end, uint32_t* out)
+{
+	__m128 planes[6][4];
+	for (int p = 0; p < 6; ++p)
+	{
+		for (int k = 0; k < 4; ++k) planes[p][k] = _mm_set1_ps(f.planes[p][k]);
+	}
+
+	uint32_t written = 0;
+	for (uint32_t i = begin; i < end; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(x + i);
+		__m128 cy = _mm_loadu_ps(y + i);
+		__m128 cz = _mm_loadu_ps(z + i);
+		__m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r + i));
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p)
+		{
+			__m128 dist = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(planes[p][0], cx), _mm_mul_ps(planes[p][1], cy)),
+					_mm_add_ps(_mm_mul_ps(planes[p][2], cz), planes[p][3]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, neg_r));
+		}
+
+		/* Compact the surviving lanes. Branchless, since visibility
+		 * is close to random per lane and a bit scan loop would
+		 * mispredict constantly */
+		int mask = _mm_movemask_ps(inside);
+		for (uint32_t lane = 0; lane < 4; ++lane)
+		{
+			out[written] = i + lane;
+			written += (mask >> lane) & 1;
+		}
+	}
+	return written;
+}
+#endif
+
+#if defined(CULL_HAS_AVX)
+CULL_TARGET_AVX
+static uint32_t cull_avx(const Frustum& f, const float* x, const float* y, const float* z,
+		const float* r, uint32_t begin, uint32_t end, uint32_t* out)
+{
+	__m256 planes[6][4];
+	for (int p = 0; p < 6; ++p)
+	{
+		for (int k = 0; k < 4; ++k) planes[p][k] = _mm256_set1_ps(f.planes[p][k]);
+	}
+
+	uint32_t written = 0;
+	for (uint32_t i = begin; i < end; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(x + i);
+		__m256 cy = _mm256_loadu_ps(y + i);
+		__m256 cz = _mm256_loadu_ps(z + i);
+		__m256 neg_r = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(r + i));
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p)
+		{
+			__m256 dist = _mm256_add_ps(
+					_mm256_add_ps(_mm256_mul_ps(planes[p][0], cx), _mm256_mul_ps(planes[p][1], cy)),
+					_mm256_add_ps(_mm256_mul_ps(planes[p][2], cz), planes[p][3]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, neg_r, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		for (uint32_t lane = 0; lane < 8; ++lane)
+		{
+			out[written] = i + lane;
+			written += (mask >> lane) & 1;
+		}
+	}
+	return written;
+}
+#endif
+
+uint32_t Frustum_Culler::add(const float center[3], float radius)
+{
+	uint32_t index = this->count++;
+	uint32_t padded = pad_lanes(this->count);
+	if (padded > this->radius.size())
+	{
+		/* Padding spheres have -inf radius, so they are never visible */
+		this->center_x.resize(padded, 0.0f);
+		this->center_y.resize(padded, 0.0f);
+		this->center_z.resize(padded, 0.0f);
+		this->radius.resize(padded, -INFINITY);
+	}
+	this->set(index, center, radius);
+	return index;
+}
+
+void Frustum_Culler::set(uint32_t index, const float center[3], float radius)
+{
+	this->center_x[index] = center[0];
+	this->center_y[index] = center[1];
+	this->center_z[index] = center[2];
+	this->radius[index] = radius;
+}
+
+void Frustum_Culler::clear()
+{
+	this->center_x.clear();
+	this->center_y.clear();
+	this->center_z.clear();
+	this->radius.clear();
+	this->count = 0;
+}
+
+uint32_t Frustum_Culler::cull_range(const Frustum& frustum, uint32_t begin, uint32_t end, uint32_t* out) const
+{
+	const float* x = this->center_x.data();
+	const float* y = this->center_y.data();
+	const float* z = this->center_z.data();
+	const float* r = this->radius.data();
+
+	switch (this->kernel)
+	{
+#if defined(CULL_HAS_AVX)
+		case CULL_AVX:
+			return cull_avx(frustum, x, y, z, r, begin, end, out);
+#endif
+#if defined(CULL_X86)
+		case CULL_SSE:
+			return cull_sse(frustum, x, y, z, r, begin, end, out);
+#endif
+		default:
+			return cull_scalar(frustum, x, y, z, r, begin, end, out);
+	}
+}
+
+uint32_t Frustum_Culler::cull(const Frustum& frustum, std::vector<uint32_t>& visible, Job_System* jobs)
+{
+	/* Worst case everything is visible. Every batch writes from its
+	 * own first index, so batches never overlap and the results only
+	 * need sliding down afterwards */
+	visible.resize(pad_lanes(this->count));
+	if (this->count == 0) return 0;
+
+	uint32_t batches = (this->count + CULL_BATCH_SIZE - 1) / CULL_BATCH_SIZE;
+	this->batch_visible.resize(batches);
+
+	auto run_batch = [this, &frustum, &visible](uint32_t begin, uint32_t end) {
+		uint32_t batch = begin / CULL_BATCH_SIZE;
+		/* Only the last batch ends early, and only it runs into padding */
+		uint32_t last = end == this->count ? pad_lanes(end) : end;
+		this->batch_visible[batch] = this->cull_range(frustum, begin, last, visible.data() + begin);
+	};
+
+	if (jobs && batches > 1)
+	{
+		jobs->parallel_for(this->count, CULL_BATCH_SIZE, run_batch);
+	} else
+	{
+		for (uint32_t begin = 0; begin < this->count; begin += CULL_BATCH_SIZE)
+		{
+			uint32_t end = begin + CULL_BATCH_SIZE < this->count ? begin + CULL_BATCH_SIZE : this->count;
+			run_batch(begin, end);
+		}
+	}
+
+	uint32_t total = this->batch_visible[0];
+	for (uint32_t b = 1; b < batches; ++b)
+	{
+		const uint32_t* src = visible.data() + b * CULL_BATCH_SIZE;
+		for (uint32_t i = 0; i < this->batch_visible[b]; ++i) visible[total + i] = src[i];
+		total += this->batch_visible[b];
+	}
+	visible.resize(total);
+	return total;
+}
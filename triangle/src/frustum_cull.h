@@ -0,0 +1,68 @@
+#ifndef FRUSTUM_CULL_H
+#define FRUSTUM_CULL_H
+#include <cstdint>
+#include <vector>
+
+struct Job_System;
+
+/* Objects per parallel_for batch, small enough to spread a few
+ * thousand objects over every core, big enough to amortize a job */
+const uint32_t CULL_BATCH_SIZE = 2048;
+
+/* Six planes pointing inward, (a, b, c, d) with a point p inside a
+ * plane when a*p.x + b*p.y + c*p.z + d >= 0 */
+struct Frustum
+{
+	float planes[6][4];
+
+	/* Gribb/Hartmann plane extraction from a column major view
+	 * projection matrix with Vulkan's 0..1 clip depth */
+	static Frustum from_view_proj(const float* m);
+};
+
+enum Cull_Kernel
+{
+	CULL_SCALAR,
+	CULL_SSE,
+	CULL_AVX,
+};
+
+/* Widest kernel this CPU can run */
+Cull_Kernel best_cull_kernel();
+const char* cull_kernel_name(Cull_Kernel kernel);
+
+/* Bounding spheres of every drawable object, tested against the
+ * camera frustum once per frame.
+ *
+ * Bounds live in separate x/y/z/radius arrays so the kernels can load
+ * 4 or 8 objects per instruction with no shuffling. The arrays are
+ * padded with spheres that can never pass, so the kernels only ever
+ * work on whole vectors.
+ *
+ * The output is the indices of the objects that survived in
+ * ascending order, ready for the draw path to walk. */
+struct Frustum_Culler
+{
+	Cull_Kernel kernel = best_cull_kernel();
+
+	/* Returns the object's index */
+	uint32_t add(const float center[3], float radius);
+	void set(uint32_t index, const float center[3], float radius);
+	void clear();
+	uint32_t size() const { return this->count; }
+
+	/* Fills visible, splitting the work over jobs if it's given.
+	 * Returns the number of visible objects */
+	uint32_t cull(const Frustum& frustum, std::vector<uint32_t>& visible, Job_System* jobs = nullptr);
+private:
+	std::vector<float> center_x;
+	std::vector<float> center_y;
+	std::vector<float> center_z;
+	std::vector<float> radius;
+	uint32_t count = 0;
+	/* Visible count of each batch from the last cull */
+	std::vector<uint32_t> batch_visible;
+
+	uint32_t cull_range(const Frustum& frustum, uint32_t begin, uint32_t end, uint32_t* out) const;
+};
+#endif /* !FRUSTUM_CULL_H */
@@ -0,0 +1,295 @@
+/*
+ * host_allocator.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Scope aware VkAllocationCallbacks, see host_allocator.h
+ */
+
+#include "host_allocator.h"
+#include <cstdlib>
+#include <cstring>
+
+/* Every allocation is preceded by one of these, so free and
+ * realloc know where the block came from */
+enum Alloc_Source : uint32_t
+{
+	SOURCE_ARENA,
+	SOURCE_POOL,
+	SOURCE_HEAP,
+};
+
+struct alignas(16) Alloc_Header
+{
+	void* raw;           // Arena, pool block or malloc'd pointer
+	uint64_t size;       // Size the driver asked for
+	uint32_t scope;
+	uint32_t source;
+	uint32_t size_class;
+	uint32_t pad;
+};
+static_assert(sizeof(Alloc_Header) == 32, "keep the header a multiple of 16");
+
+const size_t ARENA_SIZE = 256 * 1024;
+const size_t ARENA_ALIGN = 64;
+const size_t POOL_CHUNK_SIZE = 64 * 1024;
+const size_t POOL_MIN_BLOCK = 32;
+
+/* Per thread arena for COMMAND scope allocations. Only the owning
+ * thread bumps it, frees may come from anywhere so live is atomic */
+struct Linear_Arena
+{
+	char* base = nullptr;
+	size_t offset = 0;
+	std::atomic<int> live{0};
+
+	~Linear_Arena() { std::free(this->base); }
+};
+static thread_local Linear_Arena t_arena;
+
+static uintptr_t align_up(uintptr_t value, size_t alignment)
+{
+	return (value + alignment - 1) & ~(uintptr_t) (alignment - 1);
+}
+
+static const char* scope_name(int scope)
+{
+	static const char* names[HOST_ALLOC_SCOPE_COUNT] = {
+		"command", "object", "cache", "device", "instance",
+	};
+	return names[scope];
+}
+
+Host_Allocator::Host_Allocator()
+{
+	this->vk_callbacks.pUserData = this;
+	this->vk_callbacks.pfnAllocation = vk_allocate;
+	this->vk_callbacks.pfnReallocation = vk_reallocate;
+	this->vk_callbacks.pfnFree = vk_free;
+	this->vk_callbacks.pfnInternalAllocation = vk_internal_alloc;
+	this->vk_callbacks.pfnInternalFree = vk_internal_free;
+}
+
+/* Must outlive every object created with callbacks() */
+Host_Allocator::~Host_Allocator()
+{
+	void* chunk = this->chunks;
+	while (chunk)
+	{
+		void* next = *static_cast<void**>(chunk);
+		std::free(chunk);
+		chunk = next;
+	}
+}
+
+uint64_t Host_Allocator::total_allocs() const
+{
+	uint64_t total = 0;
+	for (int i = 0; i < HOST_ALLOC_SCOPE_COUNT; ++i)
+	{
+		total += this->scope_stats[i].allocs.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+void Host_Allocator::report(std::ostream& out) const
+{
+	out << "host allocations by scope:" << std::endl;
+	for (int i = 0; i < HOST_ALLOC_SCOPE_COUNT; ++i)
+	{
+		const Host_Scope_Stats& s = this->scope_stats[i];
+		out << "  " << scope_name(i)
+			<< ": allocs " << s.allocs
+			<< ", frees " << s.frees
+			<< ", reallocs " << s.reallocs
+			<< ", live " << s.live_bytes << "B"
+			<< ", peak " << s.peak_bytes << "B"
+			<< ", malloc fallbacks " << s.heap_fallbacks
+			<< ", internal " << s.internal_bytes << "B" << std::endl;
+	}
+}
+
+void Host_Allocator::track_alloc(VkSystemAllocationScope scope, size_t size)
+{
+	Host_Scope_Stats& s = this->scope_stats[scope];
+	s.allocs.fetch_add(1, std::memory_order_relaxed);
+	uint64_t live = s.live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+	uint64_t peak = s.peak_bytes.load(std::memory_order_relaxed);
+	while (live > peak && !s.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+}
+
+void* Host_Allocator::allocate(size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (size == 0) return nullptr;
+	if (alignment < 16) alignment = 16;
+
+	/* Room for the header while keeping the user pointer aligned */
+	size_t header_space = align_up(sizeof(Alloc_Header), alignment);
+	char* user = nullptr;
+	Alloc_Header header{};
+	header.size = size;
+	header.scope = scope;
+
+	if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND && alignment <= ARENA_ALIGN)
+	{
+		Linear_Arena& arena = t_arena;
+		if (!arena.base)
+		{
+			arena.base = static_cast<char*>(std::aligned_alloc(ARENA_ALIGN, ARENA_SIZE));
+		}
+		/* Nothing live, so the whole arena is ours again */
+		if (arena.live.load(std::memory_order_acquire) == 0) arena.offset = 0;
+
+		size_t start = align_up(arena.offset, alignment);
+		if (arena.base && start + header_space + size <= ARENA_SIZE)
+		{
+			user = arena.base + start + header_space;
+			arena.offset = start + header_space + size;
+			arena.live.fetch_add(1, std::memory_order_relaxed);
+			header.raw = &arena;
+			header.source = SOURCE_ARENA;
+		}
+	} else if (scope != VK_SYSTEM_ALLOCATION_SCOPE_COMMAND && alignment == 16)
+	{
+		size_t total = size + sizeof(Alloc_Header);
+		for (int c = 0; c < HOST_POOL_CLASS_COUNT; ++c)
+		{
+			if ((POOL_MIN_BLOCK << c) < total) continue;
+
+			char* block = static_cast<char*>(this->pool_alloc(c));
+			if (block)
+			{
+				user = block + sizeof(Alloc_Header);
+				header.raw = block;
+				header.source = SOURCE_POOL;
+				header.size_class = c;
+			}
+			break;
+		}
+	}
+
+	if (!user)
+	{
+		char* raw = static_cast<char*>(std::malloc(size + sizeof(Alloc_Header) + alignment));
+		if (!raw) return nullptr;
+		user = reinterpret_cast<char*>(align_up(reinterpret_cast<uintptr_t>(raw) + sizeof(Alloc_Header), alignment));
+		header.raw = raw;
+		header.source = SOURCE_HEAP;
+		this->scope_stats[scope].heap_fallbacks.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	memcpy(user - sizeof(Alloc_Header), &header, sizeof(header));
+	this->track_alloc(scope, size);
+	return user;
+}
+
+void* Host_Allocator::reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (!original) return this->allocate(size, alignment, scope);
+	if (size == 0)
+	{
+		this->free(original);
+		return nullptr;
+	}
+
+	Alloc_Header* old_header = static_cast<Alloc_Header*>(original) - 1;
+	void* memory = this->allocate(size, alignment, scope);
+	/* On failure the spec wants the original left alone */
+	if (!memory) return nullptr;
+
+	memcpy(memory, original, size < old_header->size ? size : old_header->size);
+	this->free(original);
+	this->scope_stats[scope].reallocs.fetch_add(1, std::memory_order_relaxed);
+	return memory;
+}
+
+void Host_Allocator::free(void* memory)
+{
+	if (!memory) return;
+
+	Alloc_Header* header = static_cast<Alloc_Header*>(memory) - 1;
+	Host_Scope_Stats& s = this->scope_stats[header->scope];
+	s.frees.fetch_add(1, std::memory_order_relaxed);
+	s.live_bytes.fetch_sub(header->size, std::memory_order_relaxed);
+
+	switch (header->source)
+	{
+		case SOURCE_ARENA:
+			static_cast<Linear_Arena*>(header->raw)->live.fetch_sub(1, std::memory_order_release);
+			break;
+		case SOURCE_POOL:
+			this->pool_free(header->raw, header->size_class);
+			break;
+		default:
+			std::free(header->raw);
+			break;
+	}
+}
+
+void* Host_Allocator::pool_alloc(int size_class)
+{
+	Pool_Class& pool = this->pools[size_class];
+	std::lock_guard<std::mutex> lock(pool.mutex);
+
+	if (!pool.free_list)
+	{
+		/* Carve a fresh chunk into blocks. The first block's worth
+		 * is kept back to link the chunk for destruction */
+		char* chunk = static_cast<char*>(std::aligned_alloc(16, POOL_CHUNK_SIZE));
+		if (!chunk) return nullptr;
+		{
+			std::lock_guard<std::mutex> chunk_lock(this->chunk_mutex);
+			*reinterpret_cast<void**>(chunk) = this->chunks;
+			this->chunks = chunk;
+		}
+
+		size_t block_size = POOL_MIN_BLOCK << size_class;
+		for (size_t off = block_size; off + block_size <= POOL_CHUNK_SIZE; off += block_size)
+		{
+			*reinterpret_cast<void**>(chunk + off) = pool.free_list;
+			pool.free_list = chunk + off;
+		}
+	}
+
+	void* block = pool.free_list;
+	pool.free_list = *static_cast<void**>(block);
+	return block;
+}
+
+void Host_Allocator::pool_free(void* block, int size_class)
+{
+	Pool_Class& pool = this->pools[size_class];
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	*static_cast<void**>(block) = pool.free_list;
+	pool.free_list = block;
+}
+
+/* Vulkan facing trampolines */
+VKAPI_ATTR void* VKAPI_CALL Host_Allocator::vk_allocate(void* user, size_t size, size_t alignment,
+		VkSystemAllocationScope scope)
+{
+	return static_cast<Host_Allocator*>(user)->allocate(size, alignment, scope);
+}
+
+VKAPI_ATTR void* VKAPI_CALL Host_Allocator::vk_reallocate(void* user, void* original, size_t size,
+		size_t alignment, VkSystemAllocationScope scope)
+{
+	return static_cast<Host_Allocator*>(user)->reallocate(original, size, alignment, scope);
+}
+
+VKAPI_ATTR void VKAPI_CALL Host_Allocator::vk_free(void* user, void* memory)
+{
+	static_cast<Host_Allocator*>(user)->free(memory);
+}
+
+VKAPI_ATTR void VKAPI_CALL Host_Allocator::vk_internal_alloc(void* user, size_t size,
+		VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+	static_cast<Host_Allocator*>(user)->scope_stats[scope].internal_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+VKAPI_ATTR void VKAPI_CALL Host_Allocator::vk_internal_free(void* user, size_t size,
+		VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+	static_cast<Host_Allocator*>(user)->scope_stats[scope].internal_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
@@ -0,0 +1,85 @@
+#ifndef HOST_ALLOCATOR_H
+#define HOST_ALLOCATOR_H
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+/* One per VkSystemAllocationScope */
+const int HOST_ALLOC_SCOPE_COUNT = 5;
+
+/* Size classes served from the object/device pools, 32 bytes to 4KiB.
+ * Sizes include our header, anything bigger goes straight to malloc */
+const int HOST_POOL_CLASS_COUNT = 8;
+
+struct Host_Scope_Stats
+{
+	std::atomic<uint64_t> live_bytes{0};
+	std::atomic<uint64_t> peak_bytes{0};
+	std::atomic<uint64_t> allocs{0};
+	std::atomic<uint64_t> frees{0};
+	std::atomic<uint64_t> reallocs{0};
+	/* Allocations that missed the arena or pools and hit malloc */
+	std::atomic<uint64_t> heap_fallbacks{0};
+	/* Driver internal (executable) allocations it told us about */
+	std::atomic<uint64_t> internal_bytes{0};
+};
+
+/* VkAllocationCallbacks that route driver host allocations through
+ * scope aware pools and keep per scope statistics.
+ *
+ * COMMAND scope allocations only live for the duration of a single
+ * vk call, so they come from a per thread linear arena that rewinds
+ * as soon as nothing in it is live. Everything longer lived comes
+ * from size class free lists, so creating and destroying pipelines
+ * or swap chains recycles blocks instead of hammering malloc.
+ *
+ * Pass callbacks() wherever Vulkan takes a pAllocator, and pass the
+ * same pointer to the matching vkDestroy* call. */
+struct Host_Allocator
+{
+	Host_Allocator();
+	~Host_Allocator();
+
+	const VkAllocationCallbacks* callbacks() const { return &this->vk_callbacks; }
+	const Host_Scope_Stats& stats(VkSystemAllocationScope scope) const { return this->scope_stats[scope]; }
+
+	/* Allocation count across all scopes, diff it around a piece
+	 * of code to see how much churn it causes */
+	uint64_t total_allocs() const;
+	void report(std::ostream& out) const;
+private:
+	struct Pool_Class
+	{
+		std::mutex mutex;
+		void* free_list = nullptr;
+	};
+
+	VkAllocationCallbacks vk_callbacks;
+	Host_Scope_Stats scope_stats[HOST_ALLOC_SCOPE_COUNT];
+	Pool_Class pools[HOST_POOL_CLASS_COUNT];
+	/* Chunks backing the pools, freed on destruction */
+	std::mutex chunk_mutex;
+	void* chunks = nullptr;
+
+	void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+	void* reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	void free(void* memory);
+
+	void* pool_alloc(int size_class);
+	void pool_free(void* block, int size_class);
+	void track_alloc(VkSystemAllocationScope scope, size_t size);
+
+	static VKAPI_ATTR void* VKAPI_CALL vk_allocate(void* user, size_t size, size_t alignment,
+			VkSystemAllocationScope scope);
+	static VKAPI_ATTR void* VKAPI_CALL vk_reallocate(void* user, void* original, size_t size,
+			size_t alignment, VkSystemAllocationScope scope);
+	static VKAPI_ATTR void VKAPI_CALL vk_free(void* user, void* memory);
+	static VKAPI_ATTR void VKAPI_CALL vk_internal_alloc(void* user, size_t size,
+			VkInternalAllocationType type, VkSystemAllocationScope scope);
+	static VKAPI_ATTR void VKAPI_CALL vk_internal_free(void* user, size_t size,
+			VkInternalAllocationType type, VkSystemAllocationScope scope);
+};
+#endif /* !HOST_ALLOCATOR_H */
@@ -0,0 +1,239 @@
+/*
+ * job_system.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Work stealing job scheduler, see job_system.h
+ */
+
+#include "job_system.h"
+
+static thread_local int t_thread_index = -1;
+
+/* Work_Deque, following Le et al. "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" */
+bool Work_Deque::push(Job* job)
+{
+	int64_t b = this->bottom.load(std::memory_order_relaxed);
+	int64_t t = this->top.load(std::memory_order_acquire);
+	if (b - t >= JOB_CAPACITY) return false;
+
+	this->items[b & (JOB_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+	this->bottom.store(b + 1, std::memory_order_release);
+	return true;
+}
+
+Job* Work_Deque::pop()
+{
+	int64_t b = this->bottom.load(std::memory_order_relaxed) - 1;
+	this->bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = this->top.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		/* Empty */
+		this->bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job* job = this->items[b & (JOB_CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		/* Last item, race any thieves for it */
+		if (!this->top.compare_exchange_strong(t, t + 1,
+					std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			job = nullptr;
+		}
+		this->bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+Job* Work_Deque::steal()
+{
+	int64_t t = this->top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = this->bottom.load(std::memory_order_acquire);
+	if (t >= b) return nullptr;
+
+	Job* job = this->items[t & (JOB_CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (!this->top.compare_exchange_strong(t, t + 1,
+				std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+		return nullptr;
+	}
+	return job;
+}
+
+int Job_System::thread_index()
+{
+	return t_thread_index;
+}
+
+/* Must be called from the main thread */
+void Job_System::init(unsigned worker_count)
+{
+	if (worker_count == 0)
+	{
+		unsigned cores = std::thread::hardware_concurrency();
+		worker_count = cores > 1 ? cores - 1 : 1;
+	}
+
+	t_thread_index = 0;
+	this->running = true;
+	for (unsigned i = 0; i <= worker_count; ++i)
+	{
+		this->queues.push_back(new Thread_Queue());
+	}
+	for (unsigned i = 1; i <= worker_count; ++i)
+	{
+		this->workers.emplace_back(&Job_System::worker_loop, this, (int) i);
+	}
+}
+
+void Job_System::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->sleep_mutex);
+		this->running = false;
+	}
+	this->sleep_cv.notify_all();
+	for (auto& worker : this->workers)
+	{
+		worker.join();
+	}
+	this->workers.clear();
+
+	for (auto queue : this->queues)
+	{
+		delete queue;
+	}
+	this->queues.clear();
+}
+
+void Job_System::run_on_main(std::function<void()> fn)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->main_mutex);
+		this->main_jobs.push_back(std::move(fn));
+	}
+	if (this->on_main_work) this->on_main_work();
+}
+
+void Job_System::pump_main()
+{
+	std::vector<std::function<void()>> jobs;
+	{
+		std::lock_guard<std::mutex> lock(this->main_mutex);
+		jobs.swap(this->main_jobs);
+	}
+	for (auto& job : jobs)
+	{
+		job();
+	}
+}
+
+void Job_System::wait(Job_Counter* counter)
+{
+	while (!counter->done())
+	{
+		if (this->try_run_one()) continue;
+
+		/* The counter may be waiting on main thread work */
+		if (t_thread_index == 0) this->pump_main();
+		std::this_thread::yield();
+	}
+}
+
+/* Returns nullptr on threads the scheduler doesn't own, or when the
+ * next slot's job is still queued or running. Only the owning thread
+ * allocates from a queue, so checking then claiming can't race */
+Job* Job_System::allocate_job()
+{
+	if (t_thread_index < 0 || t_thread_index >= (int) this->queues.size()) return nullptr;
+
+	Thread_Queue* queue = this->queues[t_thread_index];
+	Job* job = &queue->jobs[queue->next_job & (JOB_CAPACITY - 1)];
+	if (job->in_use.load(std::memory_order_acquire)) return nullptr;
+
+	job->in_use.store(true, std::memory_order_relaxed);
+	queue->next_job++;
+	return job;
+}
+
+void Job_System::submit(Job* job)
+{
+	if (!this->queues[t_thread_index]->deque.push(job))
+	{
+		/* Deque is full, just get on with it here */
+		this->execute(job);
+		return;
+	}
+
+	this->queued.fetch_add(1, std::memory_order_seq_cst);
+	if (this->sleeping.load(std::memory_order_seq_cst) > 0)
+	{
+		std::lock_guard<std::mutex> lock(this->sleep_mutex);
+		this->sleep_cv.notify_one();
+	}
+}
+
+bool Job_System::try_run_one()
+{
+	int self = t_thread_index;
+	int count = (int) this->queues.size();
+	/* Foreign threads have no deque of their own, they can only steal */
+	bool owned = self >= 0 && self < count;
+
+	Job* job = owned ? this->queues[self]->deque.pop() : nullptr;
+	/* Nothing local, go steal, starting from our neighbour so
+	 * thieves don't all pile onto the same victim */
+	int first = owned ? self + 1 : 0;
+	for (int i = 0; !job && i < count - owned; ++i)
+	{
+		job = this->queues[(first + i) % count]->deque.steal();
+	}
+	if (!job) return false;
+
+	this->queued.fetch_sub(1, std::memory_order_relaxed);
+	this->execute(job);
+	return true;
+}
+
+void Job_System::execute(Job* job)
+{
+	job->fn(job);
+	/* Read before the slot is handed back, it may be reused at once */
+	Job_Counter* counter = job->counter;
+	job->in_use.store(false, std::memory_order_release);
+	if (counter) counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+void Job_System::worker_loop(int index)
+{
+	t_thread_index = index;
+
+	while (this->running)
+	{
+		if (this->try_run_one()) continue;
+
+		/* Spin a little before sleeping, new work usually
+		 * turns up in bursts */
+		bool found = false;
+		for (int i = 0; i < 64 && !found; ++i)
+		{
+			std::this_thread::yield();
+			found = this->try_run_one();
+		}
+		if (found) continue;
+
+		std::unique_lock<std::mutex> lock(this->sleep_mutex);
+		this->sleeping.fetch_add(1, std::memory_order_seq_cst);
+		this->sleep_cv.wait(lock, [this] {
+			return !this->running || this->queued.load(std::memory_order_seq_cst) > 0;
+		});
+		this->sleeping.fetch_sub(1, std::memory_order_seq_cst);
+	}
+}
@@ -0,0 +1,160 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/* Max jobs in flight per thread, must be a power of two */
+const int JOB_CAPACITY = 4096;
+
+/* Counts outstanding jobs. Anything waiting on a counter helps
+ * run other jobs until it hits zero, so waiting never idles a core. */
+struct Job_Counter
+{
+	std::atomic<int> pending{0};
+	bool done() const { return this->pending.load(std::memory_order_acquire) == 0; }
+};
+
+/* A job is a function pointer plus a small inline copy of the callable,
+ * so scheduling one never touches the heap */
+struct Job
+{
+	void (*fn)(Job*);
+	Job_Counter* counter;
+	/* Set while queued or running, a slot is only reused once its
+	 * last job has finished */
+	std::atomic<bool> in_use{false};
+	alignas(16) unsigned char data[48];
+};
+
+/* Chase-Lev work stealing deque. The owning thread pushes and pops
+ * the bottom, any other thread may steal from the top. */
+struct Work_Deque
+{
+	bool push(Job* job);
+	Job* pop();
+	Job* steal();
+private:
+	std::atomic<int64_t> top{0};
+	std::atomic<int64_t> bottom{0};
+	std::atomic<Job*> items[JOB_CAPACITY];
+};
+
+/* Work stealing scheduler shared by every engine subsystem.
+ *
+ * One worker per core besides the main thread, each with its own
+ * deque. New jobs go on the submitting thread's deque, idle workers
+ * steal from the others and sleep once there is nothing to steal.
+ * The main thread takes part whenever it waits on a counter.
+ *
+ * GLFW (and a few other things) must only be called from the main
+ * thread, run_on_main() queues those up for pump_main(). */
+struct Job_System
+{
+	/* Called after run_on_main() queues something, so a main
+	 * loop that is blocked waiting for events can be woken */
+	std::function<void()> on_main_work;
+
+	void init(unsigned worker_count = 0);
+	void shutdown();
+
+	template <typename F>
+	void run(Job_Counter* counter, F&& fn);
+	void run_on_main(std::function<void()> fn);
+	/* Main thread only, runs everything queued with run_on_main */
+	void pump_main();
+
+	/* Help out until counter reaches zero */
+	void wait(Job_Counter* counter);
+
+	/* Splits [0, count) into batches of at most batch_size and calls
+	 * fn(begin, end) on each, returns once all are done */
+	template <typename F>
+	void parallel_for(uint32_t count, uint32_t batch_size, F&& fn);
+
+	unsigned thread_count() const { return (unsigned) this->queues.size(); }
+	/* 0 on the main thread, 1.. on workers, -1 on foreign threads */
+	static int thread_index();
+private:
+	struct Thread_Queue
+	{
+		Work_Deque deque;
+		Job jobs[JOB_CAPACITY];
+		uint32_t next_job = 0;
+	};
+
+	std::vector<Thread_Queue*> queues;
+	std::vector<std::thread> workers;
+	std::atomic<bool> running{false};
+
+	/* Sleeping workers. queued counts jobs sitting in deques,
+	 * checked under sleep_mutex so a push can't slip past a worker
+	 * on its way to sleep */
+	std::atomic<int> queued{0};
+	std::atomic<int> sleeping{0};
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_cv;
+
+	std::mutex main_mutex;
+	std::vector<std::function<void()>> main_jobs;
+
+	Job* allocate_job();
+	void submit(Job* job);
+	bool try_run_one();
+	void execute(Job* job);
+	void worker_loop(int index);
+};
+
+template <typename F>
+void Job_System::run(Job_Counter* counter, F&& fn)
+{
+	using Fn = typename std::decay<F>::type;
+	static_assert(sizeof(Fn) <= sizeof(Job::data), "job capture too big, capture by reference");
+	static_assert(alignof(Fn) <= 16, "job capture over aligned");
+
+	/* Threads the scheduler doesn't know about just run it inline,
+	 * and so does everyone else once their ring of slots is full */
+	Job local;
+	Job* job = this->allocate_job();
+	if (!job) job = &local;
+
+	new (job->data) Fn(std::forward<F>(fn));
+	job->fn = [](Job* j) {
+		Fn* f = reinterpret_cast<Fn*>(j->data);
+		(*f)();
+		f->~Fn();
+	};
+	job->counter = counter;
+	if (counter) counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+	if (job == &local)
+	{
+		this->execute(job);
+		return;
+	}
+	this->submit(job);
+}
+
+template <typename F>
+void Job_System::parallel_for(uint32_t count, uint32_t batch_size, F&& fn)
+{
+	if (count == 0) return;
+	if (batch_size == 0) batch_size = 1;
+
+	Job_Counter counter;
+	for (uint32_t begin = 0; begin < count; begin += batch_size)
+	{
+		uint32_t end = begin + batch_size < count ? begin + batch_size : count;
+		auto* f = &fn;
+		this->run(&counter, [f, begin, end] { (*f)(begin, end); });
+	}
+	this->wait(&counter);
+}
+#endif /* !JOB_SYSTEM_H */
@@ -1,4 +1,17 @@
 #include "vulkan_boilerplate.h"
+#include "frame_limiter.h"
+#include "job_system.h"
+#include "simulation.h"
+
+#include <cmath>
+#include <string>
+
+enum class Loop_Mode
+{
+	CONTINUOUS, // Redraw every frame, capped by the frame limiter
+	ON_DEMAND,  // Only redraw when something asked for it, sleep otherwise
+};
+
 /*
  * Should only manage window event loop and
  * handle top level bookends. For coherency this should never
@@ -7,29 +20,195 @@
 struct Hello_Triangle_App
 {
 	Vk_Wrapper vulkan;
+	Job_System jobs;
 	GLFWwindow* window;
+	bool capturing = false;
+	Loop_Mode loop_mode = Loop_Mode::ON_DEMAND;
+	Frame_Limiter limiter;
+	Sim_Thread sim;
+	Input_State input;
+	/* How long to block in glfwWaitEventsTimeout when idle, so
+	 * anything time based still gets a look in now and then */
+	double idle_timeout = 0.5;
+	bool redraw_requested = true;
+	/* Optional .tmsh drawn as a field of instances */
+	std::string mesh_path;
+	float scene_extent = 0.0f;
+
+	void request_redraw() { this->redraw_requested = true; }
+
 	void run()
 	{
+		this->jobs.init();
 		this->vulkan.init();
 		this->window = this->vulkan.window;
+		if (!this->mesh_path.empty()) this->load_scene();
+		glfwSetWindowUserPointer(this->window, this);
+		glfwSetKeyCallback(this->window, key_callback);
+		glfwSetWindowRefreshCallback(this->window, refresh_callback);
+		glfwSetWindowFocusCallback(this->window, focus_callback);
+		glfwSetCursorPosCallback(this->window, cursor_callback);
+		glfwSetMouseButtonCallback(this->window, mouse_button_callback);
+		glfwSetScrollCallback(this->window, scroll_callback);
+		this->limiter.set_target_fps(monitor_refresh_rate());
+
+		/* glfwPostEmptyEvent is the one GLFW call that is safe off
+		 * the main thread, use it to wake us when the sim moves */
+		this->sim.on_publish = [] { glfwPostEmptyEvent(); };
+		this->jobs.on_main_work = [] { glfwPostEmptyEvent(); };
+		this->sim.start();
 		this->mainLoop();
+		this->sim.stop();
 		this->vulkan.cleanup();
+		this->jobs.shutdown();
+	}
+
+	/* A square grid of copies, far more than are ever on screen at
+	 * once, so there is plenty for the GPU culling to throw away */
+	void load_scene()
+	{
+		const int grid = 100;
+
+		Mesh_File file;
+		file.open(this->mesh_path);
+		float spacing = 3.0f * file.header().radius;
+
+		std::vector<Mesh_Instance> instances;
+		instances.reserve(grid * grid);
+		for (int z = 0; z < grid; ++z)
+		{
+			for (int x = 0; x < grid; ++x)
+			{
+				Mesh_Instance inst{};
+				inst.position[0] = (x - grid / 2) * spacing;
+				inst.position[2] = (z - grid / 2) * spacing;
+				inst.scale = 1.0f;
+				instances.push_back(inst);
+			}
+		}
+		this->vulkan.load_scene(file, instances);
+		this->scene_extent = grid * spacing * 0.5f;
+		this->vulkan.camera.z_far = 4.0f * this->scene_extent;
+		this->vulkan.camera.z_near = 0.05f * spacing;
+	}
+
+	/* The sim's angle orbits the camera, its offset pans it */
+	void update_camera(const Scene_Params& scene)
+	{
+		Camera& cam = this->vulkan.camera;
+		float distance = 0.25f * this->scene_extent;
+		cam.target[0] = scene.offset[0] * this->scene_extent;
+		cam.target[1] = 0.0f;
+		cam.target[2] = scene.offset[1] * this->scene_extent;
+		cam.eye[0] = cam.target[0] + distance * std::sin(scene.angle);
+		cam.eye[1] = 0.2f * distance;
+		cam.eye[2] = cam.target[2] + distance * std::cos(scene.angle);
+	}
+
+	/* Cap at what the primary monitor can show, anything past that
+	 * is never seen. 60 if GLFW can't tell */
+	static double monitor_refresh_rate()
+	{
+		GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+		const GLFWvidmode* mode = monitor ? glfwGetVideoMode(monitor) : nullptr;
+		return mode && mode->refreshRate > 0 ? mode->refreshRate : 60.0;
+	}
+
+	static Hello_Triangle_App* from_window(GLFWwindow* window)
+	{
+		return reinterpret_cast<Hello_Triangle_App*>(glfwGetWindowUserPointer(window));
+	}
+
+	/* F12 grabs a single frame, F11 toggles continuous capture,
+	 * F10 toggles between continuous and on demand redraw */
+	static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+	{
+		auto app = from_window(window);
+		app->request_redraw();
+
+		/* Held keys are forwarded to the sim thread */
+		bool held = action != GLFW_RELEASE;
+		switch (key)
+		{
+			case GLFW_KEY_LEFT:  app->input.left = held; break;
+			case GLFW_KEY_RIGHT: app->input.right = held; break;
+			case GLFW_KEY_UP:    app->input.up = held; break;
+			case GLFW_KEY_DOWN:  app->input.down = held; break;
+			case GLFW_KEY_SPACE: if (action == GLFW_PRESS) app->input.spin_presses++; break;
+		}
+		app->sim.publish_input(app->input);
+
+		if (action != GLFW_PRESS) return;
+
+		if (key == GLFW_KEY_F12)
+		{
+			app->vulkan.capture.capture_next();
+		} else if (key == GLFW_KEY_F11)
+		{
+			app->capturing = !app->capturing;
+			app->vulkan.capture.set_continuous(app->capturing);
+		} else if (key == GLFW_KEY_F10)
+		{
+			app->loop_mode = app->loop_mode == Loop_Mode::CONTINUOUS
+				? Loop_Mode::ON_DEMAND
+				: Loop_Mode::CONTINUOUS;
+		}
+	}
+
+	/* Anything the user does is a reason to redraw */
+	static void refresh_callback(GLFWwindow* window) { from_window(window)->request_redraw(); }
+	static void focus_callback(GLFWwindow* window, int focused) { from_window(window)->request_redraw(); }
+	static void cursor_callback(GLFWwindow* window, double x, double y) { from_window(window)->request_redraw(); }
+	static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+	{
+		from_window(window)->request_redraw();
+	}
+	static void scroll_callback(GLFWwindow* window, double x, double y) { from_window(window)->request_redraw(); }
+
+	bool wants_frame()
+	{
+		if (glfwGetWindowAttrib(this->window, GLFW_ICONIFIED)) return false;
+		return this->loop_mode == Loop_Mode::CONTINUOUS
+			|| this->redraw_requested
+			|| this->sim.has_update()
+			|| this->capturing;
 	}
 
 	void mainLoop()
 	{
-		/* Simple event loop */
+		/* Poll while there is work to do, otherwise block in
+		 * the event wait so an idle window costs next to nothing */
 		while(!glfwWindowShouldClose(this->window))
 		{
-			glfwPollEvents();
+			if (this->wants_frame())
+			{
+				glfwPollEvents();
+			} else
+			{
+				glfwWaitEventsTimeout(this->idle_timeout);
+				/* The old deadline is meaningless after sleeping */
+				this->limiter.reset();
+			}
+
+			/* Anything the workers need done on the main thread */
+			this->jobs.pump_main();
+			if (!this->wants_frame()) continue;
+
+			this->redraw_requested = false;
+			this->vulkan.scene = this->sim.sample();
+			this->update_camera(this->vulkan.scene);
+			this->vulkan.draw_frame();
+			this->limiter.wait();
 		}
 	}
 
 };
 
-int main()
+/* usage: main [mesh.tmsh] */
+int main(int argc, char** argv)
 {
 	Hello_Triangle_App app;
+	if (argc > 1) app.mesh_path = argv[1];
 	try
 	{
 		app.run();
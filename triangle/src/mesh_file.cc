@@ -0,0 +1,149 @@
+/*
+ * mesh_file.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Memory mapped .tmsh loading, see mesh_file.h and mesh_format.h
+ */
+
+#include "mesh_file.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Written so neither side can overflow, offset and bytes come
+ * straight from the file */
+static bool section_fits(uint64_t offset, size_t bytes, size_t size)
+{
+	return offset % MESH_SECTION_ALIGN == 0 && offset <= size && bytes <= size - offset;
+}
+
+void Mesh_File::open(const std::string& path)
+{
+	this->close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Failed to open mesh " + path);
+	}
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view)
+	{
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(file);
+		throw std::runtime_error("Failed to map mesh " + path);
+	}
+	this->file_handle = file;
+	this->mapping_handle = mapping;
+	this->data = view;
+	this->size = (size_t) file_size.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		throw std::runtime_error("Failed to open mesh " + path);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		throw std::runtime_error("Failed to stat mesh " + path);
+	}
+	void* view = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	/* The mapping keeps the file alive */
+	::close(fd);
+	if (view == MAP_FAILED)
+	{
+		throw std::runtime_error("Failed to map mesh " + path);
+	}
+	/* It's all about to be read into a staging buffer, start the I/O now */
+	madvise(view, (size_t) st.st_size, MADV_WILLNEED);
+	this->data = view;
+	this->size = (size_t) st.st_size;
+#endif
+
+	/* Validate once here so the accessors and the GPU never have to */
+	if (this->size < sizeof(Mesh_Header))
+	{
+		this->close();
+		throw std::runtime_error("Mesh file truncated: " + path);
+	}
+	const Mesh_Header& h = this->header();
+	if (h.magic != MESH_MAGIC || h.version != MESH_VERSION)
+	{
+		this->close();
+		throw std::runtime_error("Not a v" + std::to_string(MESH_VERSION) + " mesh file: " + path);
+	}
+	if ((h.index_size != 2 && h.index_size != 4)
+			|| h.file_size != this->size
+			|| !section_fits(h.vertex_offset, this->vertex_bytes(), this->size)
+			|| !section_fits(h.index_offset, this->index_bytes(), this->size)
+			|| !section_fits(h.meshlet_offset, this->meshlet_bytes(), this->size))
+	{
+		this->close();
+		throw std::runtime_error("Corrupt mesh file: " + path);
+	}
+	if (!this->contents_valid())
+	{
+		this->close();
+		throw std::runtime_error("Corrupt mesh file: " + path);
+	}
+}
+
+/* Out of range indices would have the GPU fetch past the vertex
+ * buffer, so every one is checked. Touches the whole index and
+ * meshlet sections, which upload reads straight after anyway */
+bool Mesh_File::contents_valid() const
+{
+	const Mesh_Header& h = this->header();
+	if (h.index_size == 2)
+	{
+		const uint16_t* indices = this->at<uint16_t>(h.index_offset);
+		for (uint32_t i = 0; i < h.index_count; ++i)
+		{
+			if (indices[i] >= h.vertex_count) return false;
+		}
+	} else
+	{
+		const uint32_t* indices = this->at<uint32_t>(h.index_offset);
+		for (uint32_t i = 0; i < h.index_count; ++i)
+		{
+			if (indices[i] >= h.vertex_count) return false;
+		}
+	}
+
+	const Meshlet* meshlets = this->meshlets();
+	for (uint32_t i = 0; i < h.meshlet_count; ++i)
+	{
+		if ((uint64_t) meshlets[i].first_index + meshlets[i].index_count > h.index_count) return false;
+	}
+	return true;
+}
+
+void Mesh_File::close()
+{
+	if (!this->data) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(this->data);
+	CloseHandle((HANDLE) this->mapping_handle);
+	CloseHandle((HANDLE) this->file_handle);
+#else
+	munmap(this->data, this->size);
+#endif
+	this->data = nullptr;
+	this->size = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef MESH_FILE_H
+#define MESH_FILE_H
+#include "mesh_format.h"
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+/* A .tmsh file mapped read only into memory.
+ *
+ * There is no parsing, open() checks the header, the section bounds,
+ * that every index is below vertex_count and every meshlet's range
+ * is inside the index buffer. After that every accessor is a pointer
+ * into the mapping. The vertex section is only read in when
+ * something (usually the staging copy in Vk_Wrapper::upload_mesh)
+ * touches it. */
+struct Mesh_File
+{
+	Mesh_File() = default;
+	Mesh_File(const Mesh_File&) = delete;
+	Mesh_File& operator=(const Mesh_File&) = delete;
+	~Mesh_File() { this->close(); }
+
+	void open(const std::string& path);
+	void close();
+
+	const Mesh_Header& header() const
+	{
+		if (!this->data) throw std::logic_error("Mesh_File used before open()");
+		return *static_cast<const Mesh_Header*>(this->data);
+	}
+	const Packed_Vertex* vertices() const { return this->at<Packed_Vertex>(this->header().vertex_offset); }
+	const void* indices() const { return this->at<char>(this->header().index_offset); }
+	const Meshlet* meshlets() const { return this->at<Meshlet>(this->header().meshlet_offset); }
+
+	size_t vertex_bytes() const { return (size_t) this->header().vertex_count * sizeof(Packed_Vertex); }
+	size_t index_bytes() const { return (size_t) this->header().index_count * this->header().index_size; }
+	size_t meshlet_bytes() const { return (size_t) this->header().meshlet_count * sizeof(Meshlet); }
+private:
+	void* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+
+	bool contents_valid() const;
+
+	template <typename T>
+	const T* at(uint64_t offset) const
+	{
+		return reinterpret_cast<const T*>(static_cast<const char*>(this->data) + offset);
+	}
+};
+#endif /* !MESH_FILE_H */
@@ -0,0 +1,76 @@
+#ifndef MESH_FORMAT_H
+#define MESH_FORMAT_H
+#include <cstdint>
+
+/* On disk layout of .tmsh files, written by tools/meshconv and
+ * mapped straight into memory by Mesh_File.
+ *
+ * Everything is little endian and laid out exactly as the GPU wants
+ * it, so loading is an mmap and a memcpy into a staging buffer.
+ *
+ *   Mesh_Header
+ *   Packed_Vertex[vertex_count]
+ *   uint16_t or uint32_t[index_count]   (index_size bytes each)
+ *   Meshlet[meshlet_count]
+ *
+ * with every section starting on a MESH_SECTION_ALIGN boundary. */
+
+const uint32_t MESH_MAGIC = 0x48534d54; // "TMSH"
+const uint32_t MESH_VERSION = 1;
+const uint32_t MESH_SECTION_ALIGN = 16;
+
+/* Meshlet limits, small enough for a mesh shader workgroup later on */
+const uint32_t MESHLET_MAX_VERTICES = 64;
+const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+/* 16 bytes, every attribute in a format the spec requires vertex
+ * buffer support for:
+ *   position  R16G16B16A16_UNORM, dequantized with the header's
+ *             pos_offset + q * pos_scale (w unused)
+ *   normal    R8G8_SNORM, octahedral encoded
+ *   uv        R16G16_SFLOAT */
+struct Packed_Vertex
+{
+	uint16_t position[4];
+	int8_t normal[2];
+	uint8_t pad[2];
+	uint16_t uv[2];
+};
+static_assert(sizeof(Packed_Vertex) == 16, "Packed_Vertex must stay 16 bytes");
+
+/* A run of triangles in the index buffer, plus what is needed to
+ * cull it without touching its vertices */
+struct Meshlet
+{
+	uint32_t first_index;
+	uint32_t index_count;
+	uint32_t vertex_count;  // Unique vertices referenced
+	uint32_t pad;
+	float center[3];        // Bounding sphere, model space
+	float radius;
+	/* Backface cone. The whole meshlet faces away from a camera at
+	 * cam when dot(center - cam, axis) >= cutoff * length(center - cam) + radius */
+	int8_t cone_axis[3];
+	int8_t cone_cutoff;     // snorm8, 127 means never cull
+	uint32_t pad2[3];
+};
+static_assert(sizeof(Meshlet) == 48, "Meshlet layout is shared with shaders");
+
+struct Mesh_Header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	uint32_t index_size;    // 2 or 4
+	uint32_t meshlet_count;
+	float pos_offset[3];
+	float pos_scale[3];
+	float center[3];        // Bounding sphere of the whole mesh
+	float radius;
+	uint64_t vertex_offset; // Byte offsets from the start of the file
+	uint64_t index_offset;
+	uint64_t meshlet_offset;
+	uint64_t file_size;
+};
+#endif /* !MESH_FORMAT_H */
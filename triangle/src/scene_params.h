@@ -0,0 +1,11 @@
+#ifndef SCENE_PARAMS_H
+#define SCENE_PARAMS_H
+
+/* Push constant block read by vert.glsl, keep the two in sync.
+ * Produced by Sim_Thread, consumed by Vk_Wrapper */
+struct Scene_Params
+{
+	float offset[2];
+	float angle;
+};
+#endif /* !SCENE_PARAMS_H */
@@ -0,0 +1,122 @@
+#version 450
+#pragma shader_stage(compute)
+
+// One thread per instance. Survivors of the frustum and occlusion
+// tests append a draw command, which the mesh pass then draws with
+// vkCmdDrawIndexedIndirectCount.
+layout(local_size_x = 64) in;
+
+// Must match Cull_Params in vulkan_boilerplate.h
+layout(std140, set = 0, binding = 0) uniform Cull_Params {
+	mat4 view_proj;
+	mat4 occlusion_view_proj;
+	vec4 planes[6];
+	vec4 mesh_sphere;
+	uint instance_count;
+	uint index_count;
+	uint occlusion;
+	uint pyramid_levels;
+	vec2 pyramid_size;
+} params;
+
+// Must match Mesh_Instance in vulkan_boilerplate.h
+struct Instance {
+	vec3 position;
+	float scale;
+};
+
+// VkDrawIndexedIndirectCommand
+struct Draw {
+	uint index_count;
+	uint instance_count;
+	uint first_index;
+	int vertex_offset;
+	uint first_instance;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Instances {
+	Instance instances[];
+};
+
+layout(std430, set = 0, binding = 2) writeonly buffer Draws {
+	Draw draws[];
+};
+
+layout(std430, set = 0, binding = 3) buffer Draw_Count {
+	uint draw_count;
+};
+
+// Max depth pyramid built from last frame's depth buffer
+layout(set = 0, binding = 4) uniform sampler2D depth_pyramid;
+
+bool in_frustum(vec3 center, float radius)
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		if (dot(params.planes[i].xyz, center) + params.planes[i].w < -radius) return false;
+	}
+	return true;
+}
+
+// Projects the sphere's bounding box with the matrix the pyramid was
+// rendered with, then compares its nearest depth against the farthest
+// depth under its screen rectangle
+bool occluded(vec3 center, float radius)
+{
+	vec2 lo = vec2(1.0);
+	vec2 hi = vec2(-1.0);
+	float nearest = 1.0;
+	for (int i = 0; i < 8; ++i)
+	{
+		vec3 corner = center + radius * vec3(
+				(i & 1) != 0 ? 1.0 : -1.0,
+				(i & 2) != 0 ? 1.0 : -1.0,
+				(i & 4) != 0 ? 1.0 : -1.0);
+		vec4 clip = params.occlusion_view_proj * vec4(corner, 1.0);
+		// Crosses the camera plane, nothing sensible to test
+		if (clip.w <= 0.0) return false;
+		vec3 ndc = clip.xyz / clip.w;
+		lo = min(lo, ndc.xy);
+		hi = max(hi, ndc.xy);
+		nearest = min(nearest, ndc.z);
+	}
+	if (nearest <= 0.0) return false;
+
+	vec2 uv_lo = clamp(lo * 0.5 + 0.5, 0.0, 1.0);
+	vec2 uv_hi = clamp(hi * 0.5 + 0.5, 0.0, 1.0);
+
+	// Level where the rectangle is at most a texel across, so its
+	// four corner texels cover it
+	vec2 size = (uv_hi - uv_lo) * params.pyramid_size;
+	int level = int(ceil(log2(max(max(size.x, size.y), 1.0))));
+	level = min(level, int(params.pyramid_levels) - 1);
+
+	ivec2 level_size = textureSize(depth_pyramid, level);
+	ivec2 a = clamp(ivec2(uv_lo * vec2(level_size)), ivec2(0), level_size - 1);
+	ivec2 b = clamp(ivec2(uv_hi * vec2(level_size)), ivec2(0), level_size - 1);
+
+	float farthest = max(
+			max(texelFetch(depth_pyramid, a, level).r, texelFetch(depth_pyramid, ivec2(b.x, a.y), level).r),
+			max(texelFetch(depth_pyramid, ivec2(a.x, b.y), level).r, texelFetch(depth_pyramid, b, level).r));
+	return nearest > farthest;
+}
+
+void main()
+{
+	uint id = gl_GlobalInvocationID.x;
+	if (id >= params.instance_count) return;
+
+	Instance inst = instances[id];
+	vec3 center = inst.position + params.mesh_sphere.xyz * inst.scale;
+	float radius = params.mesh_sphere.w * inst.scale;
+
+	if (!in_frustum(center, radius)) return;
+	if (params.occlusion != 0 && occluded(center, radius)) return;
+
+	uint slot = atomicAdd(draw_count, 1u);
+	draws[slot].index_count = params.index_count;
+	draws[slot].instance_count = 1;
+	draws[slot].first_index = 0;
+	draws[slot].vertex_offset = 0;
+	draws[slot].first_instance = id;
+}
@@ -0,0 +1,39 @@
+#version 450
+#pragma shader_stage(compute)
+
+// Builds one level of the max depth pyramid. Each output texel takes
+// the farthest depth of the source texels it covers, so anything
+// behind it is behind everything in that region.
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// The depth buffer for level 0, the pyramid itself after that
+layout(set = 0, binding = 0) uniform sampler2D src;
+layout(set = 0, binding = 1, r32f) uniform writeonly image2D dst;
+
+layout(push_constant) uniform Reduce_Params {
+	ivec2 src_size; // Part of src in use, dynamic resolution shrinks it
+	ivec2 dst_size;
+	int src_level;
+} params;
+
+void main()
+{
+	ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(p, params.dst_size))) return;
+
+	// The footprint isn't always 2x2, level 0 maps an arbitrary
+	// render extent onto a power of two
+	vec2 ratio = vec2(params.src_size) / vec2(params.dst_size);
+	ivec2 lo = ivec2(floor(vec2(p) * ratio));
+	ivec2 hi = min(ivec2(ceil(vec2(p + 1) * ratio)), params.src_size);
+
+	float farthest = 0.0;
+	for (int y = lo.y; y < hi.y; ++y)
+	{
+		for (int x = lo.x; x < hi.x; ++x)
+		{
+			farthest = max(farthest, texelFetch(src, ivec2(x, y), params.src_level).r);
+		}
+	}
+	imageStore(dst, p, vec4(farthest));
+}
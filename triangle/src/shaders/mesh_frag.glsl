@@ -0,0 +1,15 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#pragma shader_stage(fragment)
+
+layout(location = 0) in vec3 frag_normal;
+
+layout(location = 0) out vec4 out_color;
+
+// Fixed directional light plus a bit of ambient
+void main ()
+{
+	vec3 light = normalize(vec3(0.4, 0.8, 0.3));
+	float diffuse = max(dot(normalize(frag_normal), light), 0.0);
+	out_color = vec4(vec3(0.15 + 0.85 * diffuse), 1.0);
+}
@@ -0,0 +1,45 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#pragma shader_stage(vertex)
+
+// Packed_Vertex in mesh_format.h
+layout(location = 0) in vec4 in_position; // unorm16, 0..1 over the mesh bounds
+layout(location = 1) in vec2 in_normal;   // snorm8, octahedral
+layout(location = 2) in vec2 in_uv;
+
+layout(location = 0) out vec3 frag_normal;
+
+// Must match Mesh_Params in vulkan_boilerplate.h
+layout(push_constant) uniform Mesh_Params {
+	mat4 view_proj;
+	vec4 pos_offset;
+	vec4 pos_scale;
+} params;
+
+// Must match Mesh_Instance in vulkan_boilerplate.h
+struct Instance {
+	vec3 position;
+	float scale;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Instances {
+	Instance instances[];
+};
+
+vec3 oct_decode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main() {
+	// gl_InstanceIndex includes firstInstance, which the cull pass
+	// sets to the instance it drew
+	Instance inst = instances[gl_InstanceIndex];
+	vec3 local = params.pos_offset.xyz + in_position.xyz * params.pos_scale.xyz;
+	gl_Position = params.view_proj * vec4(inst.position + local * inst.scale, 1.0);
+	frag_normal = oct_decode(in_normal);
+}
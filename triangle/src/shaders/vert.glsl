@@ -4,6 +4,12 @@
 
 layout(location = 0) out vec3 frag_color;
 
+// Must match Scene_Params in scene_params.h
+layout(push_constant) uniform Scene {
+	vec2 offset;
+	float angle;
+} scene;
+
 vec2 positions[3] = vec2[](
 	vec2(0.0, -0.5),
 	vec2(0.5, 0.5),
@@ -16,6 +22,9 @@ vec3 colors[3] = vec3[](
 	vec3(0.0, 0.0, 1.0)
 );
 void main() {
-	gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
+	float c = cos(scene.angle);
+	float s = sin(scene.angle);
+	vec2 pos = mat2(c, s, -s, c) * positions[gl_VertexIndex] + scene.offset;
+	gl_Position = vec4(pos, 0.0, 1.0);
 	frag_color = colors[gl_VertexIndex];
 }
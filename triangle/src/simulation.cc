@@ -0,0 +1,121 @@
+/*
+ * simulation.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Fixed rate simulation thread, see simulation.h
+ */
+
+#include "simulation.h"
+#include <algorithm>
+#include <cmath>
+
+void Sim_Thread::start()
+{
+	this->running = true;
+	this->thread = std::thread(&Sim_Thread::loop, this);
+}
+
+void Sim_Thread::stop()
+{
+	this->running = false;
+	if (this->thread.joinable()) this->thread.join();
+}
+
+void Sim_Thread::publish_input(const Input_State& input)
+{
+	this->input.back() = input;
+	this->input.publish();
+}
+
+Scene_Params Sim_Thread::sample()
+{
+	this->output.update();
+	const Sim_Snapshot& snap = this->output.front();
+
+	/* Fraction of a tick since curr was produced. Drawing between prev
+	 * and curr rather than extrapolating past curr means we never show
+	 * a state the simulation didn't reach */
+	std::chrono::duration<float> since = std::chrono::steady_clock::now() - snap.curr_time;
+	float alpha = std::clamp(since.count() * (float) this->tick_rate, 0.0f, 1.0f);
+	this->interpolating = alpha < 1.0f;
+
+	Scene_Params params{};
+	params.offset[0] = snap.prev.offset[0] + (snap.curr.offset[0] - snap.prev.offset[0]) * alpha;
+	params.offset[1] = snap.prev.offset[1] + (snap.curr.offset[1] - snap.prev.offset[1]) * alpha;
+	/* The angle wraps at 2pi, don't spin backwards across it */
+	float delta = snap.curr.angle - snap.prev.angle;
+	if (delta < -3.14159265f) delta += 2.0f * 3.14159265f;
+	params.angle = snap.prev.angle + delta * alpha;
+	return params;
+}
+
+void Sim_Thread::loop()
+{
+	using clock = std::chrono::steady_clock;
+	auto tick_time = std::chrono::duration_cast<clock::duration>(
+			std::chrono::duration<double>(1.0 / this->tick_rate));
+	float dt = (float) (1.0 / this->tick_rate);
+
+	Sim_State state;
+	Input_State input;
+	uint32_t seen_presses = 0;
+	auto next_tick = clock::now();
+
+	while (this->running)
+	{
+		this->input.update();
+		input = this->input.front();
+
+		Sim_State prev = state;
+		step(state, input, input.spin_presses - seen_presses, dt);
+		seen_presses = input.spin_presses;
+
+		/* Nothing moved, so leave the last snapshot in place and don't
+		 * wake the renderer. has_update() keeps it drawing until the
+		 * interpolation has settled on curr */
+		bool changed = state.angle != prev.angle
+			|| state.offset[0] != prev.offset[0]
+			|| state.offset[1] != prev.offset[1];
+
+		if (changed)
+		{
+			Sim_Snapshot& snap = this->output.back();
+			snap.prev = prev;
+			snap.curr = state;
+			snap.curr_time = clock::now();
+			this->output.publish();
+
+			if (this->on_publish) this->on_publish();
+		}
+
+		/* Fixed cadence. If we fall badly behind, drop the
+		 * backlog instead of running ticks back to back */
+		next_tick += tick_time;
+		auto now = clock::now();
+		if (now - next_tick > tick_time * 4) next_tick = now;
+		std::this_thread::sleep_until(next_tick);
+	}
+}
+
+void Sim_Thread::step(Sim_State& state, const Input_State& input, uint32_t new_presses, float dt)
+{
+	const float move_speed = 1.0f;                // NDC units per second
+	const float spin_speed = 3.14159265f * 0.5f;  // Radians per second
+
+	if (new_presses & 1) state.spinning = !state.spinning;
+
+	if (state.spinning)
+	{
+		state.angle = std::fmod(state.angle + spin_speed * dt, 2.0f * 3.14159265f);
+	}
+
+	if (input.left)  state.offset[0] -= move_speed * dt;
+	if (input.right) state.offset[0] += move_speed * dt;
+	if (input.up)    state.offset[1] -= move_speed * dt;
+	if (input.down)  state.offset[1] += move_speed * dt;
+
+	state.offset[0] = std::clamp(state.offset[0], -1.0f, 1.0f);
+	state.offset[1] = std::clamp(state.offset[1], -1.0f, 1.0f);
+	state.tick++;
+}
@@ -0,0 +1,76 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+#include "scene_params.h"
+#include "triple_buffer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+/* Input as last seen by the main thread. GLFW input can only be read
+ * on the main thread, so the callbacks fill this in and hand it over */
+struct Input_State
+{
+	bool left = false;
+	bool right = false;
+	bool up = false;
+	bool down = false;
+	/* A counter rather than a flag so no presses get lost between ticks */
+	uint32_t spin_presses = 0;
+};
+
+struct Sim_State
+{
+	uint64_t tick = 0;
+	float angle = 0.0f;
+	float offset[2] = {0.0f, 0.0f};
+	bool spinning = false;
+};
+
+/* What the render thread receives, the two most recent ticks
+ * so it can interpolate between them */
+struct Sim_Snapshot
+{
+	Sim_State prev;
+	Sim_State curr;
+	std::chrono::steady_clock::time_point curr_time;
+};
+
+/* Runs the simulation at a fixed tick rate on its own thread.
+ *
+ * Input comes in and state goes out through triple buffers, so a slow
+ * frame never holds up a tick and a slow tick never holds up a frame.
+ * The renderer draws one tick behind and interpolates, which bounds
+ * input latency at one tick plus one frame. */
+struct Sim_Thread
+{
+	double tick_rate = 120.0;
+	/* Called from the sim thread whenever the state changed,
+	 * used to wake an idle main loop */
+	std::function<void()> on_publish;
+
+	void start();
+	void stop();
+
+	/* Main thread side */
+	void publish_input(const Input_State& input);
+	/* A new snapshot, or the last sample hadn't reached curr yet. The
+	 * sim stops publishing once things stop moving, so without the
+	 * latter the display would stay stuck short of the final state */
+	bool has_update() const { return this->output.has_update() || this->interpolating; }
+	/* Interpolated scene for a frame presented around now */
+	Scene_Params sample();
+private:
+	std::thread thread;
+	/* Set by sample() while alpha < 1, main thread only */
+	bool interpolating = false;
+	std::atomic<bool> running{false};
+	Triple_Buffer<Input_State> input;
+	Triple_Buffer<Sim_Snapshot> output;
+
+	void loop();
+	static void step(Sim_State& state, const Input_State& input, uint32_t new_presses, float dt);
+};
+#endif /* !SIMULATION_H */
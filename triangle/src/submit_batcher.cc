@@ -0,0 +1,206 @@
+/*
+ * submit_batcher.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Timeline semaphore based submission batching, see submit_batcher.h
+ */
+
+#include "submit_batcher.h"
+#include <algorithm>
+#include <stdexcept>
+
+void Submit_Batcher::init(VkDevice device, const VkAllocationCallbacks* allocator,
+		const Device_Dispatch* dispatch)
+{
+	this->device = device;
+	this->allocator = allocator;
+	this->dispatch = dispatch;
+}
+
+void Submit_Batcher::destroy()
+{
+	for (auto& batch : this->queues)
+	{
+		vkDestroySemaphore(this->device, batch.timeline, this->allocator);
+	}
+	this->queues.clear();
+}
+
+uint32_t Submit_Batcher::add_queue(VkQueue queue)
+{
+	/* Two ids for the same VkQueue would defeat the batching */
+	for (uint32_t i = 0; i < this->queues.size(); ++i)
+	{
+		if (this->queues[i].queue == queue) return i;
+	}
+
+	VkSemaphoreTypeCreateInfo type_info{};
+	type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	type_info.initialValue = 0;
+
+	VkSemaphoreCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	create_info.pNext = &type_info;
+
+	Queue_Batch batch;
+	batch.queue = queue;
+	if (vkCreateSemaphore(this->device, &create_info, this->allocator, &batch.timeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create timeline semaphore!");
+	}
+
+	this->queues.push_back(std::move(batch));
+	return (uint32_t) this->queues.size() - 1;
+}
+
+uint64_t Submit_Batcher::enqueue(uint32_t queue, VkCommandBuffer cmd)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	Queue_Batch& batch = this->queues[queue];
+	batch.cmds.push_back(cmd);
+	return batch.next_value;
+}
+
+void Submit_Batcher::add_wait(Queue_Batch& batch, VkSemaphore semaphore, uint64_t value,
+		VkPipelineStageFlags stage)
+{
+	/* Several producers waiting on the same timeline collapse
+	 * into one wait on the highest value */
+	for (size_t i = 0; i < batch.wait_sems.size(); ++i)
+	{
+		if (batch.wait_sems[i] == semaphore)
+		{
+			if (value > batch.wait_values[i]) batch.wait_values[i] = value;
+			batch.wait_stages[i] |= stage;
+			return;
+		}
+	}
+	batch.wait_sems.push_back(semaphore);
+	batch.wait_values.push_back(value);
+	batch.wait_stages.push_back(stage);
+}
+
+void Submit_Batcher::wait_for(uint32_t queue, uint32_t other_queue, uint64_t value,
+		VkPipelineStageFlags stage)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	/* Work on the same queue is already ordered by submission */
+	if (queue == other_queue) return;
+	this->add_wait(this->queues[queue], this->queues[other_queue].timeline, value, stage);
+}
+
+void Submit_Batcher::wait_binary(uint32_t queue, VkSemaphore semaphore, VkPipelineStageFlags stage)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->add_wait(this->queues[queue], semaphore, 0, stage);
+}
+
+void Submit_Batcher::signal_binary(uint32_t queue, VkSemaphore semaphore)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	Queue_Batch& batch = this->queues[queue];
+	batch.signal_sems.push_back(semaphore);
+	batch.signal_values.push_back(0); // Ignored for binary semaphores
+}
+
+void Submit_Batcher::flush()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	for (auto& batch : this->queues)
+	{
+		if (batch.cmds.empty() && batch.wait_sems.empty() && batch.signal_sems.empty()) continue;
+
+		/* The queue's own timeline always goes last */
+		batch.signal_sems.push_back(batch.timeline);
+		batch.signal_values.push_back(batch.next_value);
+
+		VkTimelineSemaphoreSubmitInfo timeline_info{};
+		timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timeline_info.waitSemaphoreValueCount = (uint32_t) batch.wait_values.size();
+		timeline_info.pWaitSemaphoreValues = batch.wait_values.data();
+		timeline_info.signalSemaphoreValueCount = (uint32_t) batch.signal_values.size();
+		timeline_info.pSignalSemaphoreValues = batch.signal_values.data();
+
+		VkSubmitInfo submit_info{};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.pNext = &timeline_info;
+		submit_info.waitSemaphoreCount = (uint32_t) batch.wait_sems.size();
+		submit_info.pWaitSemaphores = batch.wait_sems.data();
+		submit_info.pWaitDstStageMask = batch.wait_stages.data();
+		submit_info.commandBufferCount = (uint32_t) batch.cmds.size();
+		submit_info.pCommandBuffers = batch.cmds.data();
+		submit_info.signalSemaphoreCount = (uint32_t) batch.signal_sems.size();
+		submit_info.pSignalSemaphores = batch.signal_sems.data();
+
+		VkResult result = this->dispatch->QueueSubmit(batch.queue, 1, &submit_info, VK_NULL_HANDLE);
+		/* Either way the batch is gone and its value is used up. The
+		 * next batch signals past a failed one, so it's remembered
+		 * for wait() to throw on */
+		batch.clear();
+		if (result != VK_SUCCESS) batch.failed_values.push_back(batch.next_value);
+		batch.next_value++;
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to submit batch!");
+		}
+		this->submits++;
+	}
+}
+
+void Submit_Batcher::Queue_Batch::clear()
+{
+	this->cmds.clear();
+	this->wait_sems.clear();
+	this->wait_values.clear();
+	this->wait_stages.clear();
+	this->signal_sems.clear();
+	this->signal_values.clear();
+}
+
+uint64_t Submit_Batcher::completed(uint32_t queue)
+{
+	Queue_Batch& batch = this->queues[queue];
+	uint64_t value = 0;
+	this->dispatch->GetSemaphoreCounterValue(this->device, batch.timeline, &value);
+	if (value > batch.known_completed) batch.known_completed = value;
+	return batch.known_completed;
+}
+
+void Submit_Batcher::wait(uint32_t queue, uint64_t value)
+{
+	Queue_Batch& batch = this->queues[queue];
+	uint64_t next_value;
+	bool failed;
+	{
+		/* flush() may be changing both on another thread */
+		std::lock_guard<std::mutex> lock(this->mutex);
+		next_value = batch.next_value;
+		failed = std::find(batch.failed_values.begin(), batch.failed_values.end(), value)
+			!= batch.failed_values.end();
+	}
+	if (failed)
+	{
+		throw std::runtime_error("waiting on a batch that failed to submit!");
+	}
+	if (value <= batch.known_completed) return;
+	if (value >= next_value)
+	{
+		/* Would never signal, better to say so than hang */
+		throw std::runtime_error("waiting on a timeline value that was never submitted!");
+	}
+
+	VkSemaphoreWaitInfo wait_info{};
+	wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	wait_info.semaphoreCount = 1;
+	wait_info.pSemaphores = &batch.timeline;
+	wait_info.pValues = &value;
+
+	if (this->dispatch->WaitSemaphores(this->device, &wait_info, UINT64_MAX) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed waiting on timeline semaphore!");
+	}
+	batch.known_completed = value;
+}
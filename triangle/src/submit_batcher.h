@@ -0,0 +1,75 @@
+#ifndef SUBMIT_BATCHER_H
+#define SUBMIT_BATCHER_H
+#include <vulkan/vulkan.h>
+#include "device_dispatch.h"
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/* Collects command buffers from any number of producers and turns
+ * them into one vkQueueSubmit per queue per flush.
+ *
+ * Every queue gets a timeline semaphore. Enqueued work is told the
+ * timeline value its batch will signal, and that value is all anyone
+ * needs to wait on it: other queues wait for it on the GPU through
+ * wait_for(), the CPU waits for it with wait(). No per-submit fences. */
+struct Submit_Batcher
+{
+	void init(VkDevice device, const VkAllocationCallbacks* allocator, const Device_Dispatch* dispatch);
+	void destroy();
+
+	/* Returns the id used by everything else */
+	uint32_t add_queue(VkQueue queue);
+
+	/* Producers, safe from any thread. The returned value is signalled
+	 * on the queue's timeline once the batch containing cmd completes */
+	uint64_t enqueue(uint32_t queue, VkCommandBuffer cmd);
+	/* Next batch on queue waits on the GPU for other_queue to reach value */
+	void wait_for(uint32_t queue, uint32_t other_queue, uint64_t value, VkPipelineStageFlags stage);
+	/* Binary semaphores for the swap chain */
+	void wait_binary(uint32_t queue, VkSemaphore semaphore, VkPipelineStageFlags stage);
+	void signal_binary(uint32_t queue, VkSemaphore semaphore);
+
+	/* Submits every queue with pending work */
+	void flush();
+
+	/* CPU side, render thread only. wait() throws if the batch
+	 * holding value failed to submit */
+	uint64_t completed(uint32_t queue);
+	void wait(uint32_t queue, uint64_t value);
+
+	uint64_t submit_count() const { return this->submits; }
+private:
+	struct Queue_Batch
+	{
+		VkQueue queue;
+		VkSemaphore timeline;
+		/* Value the pending batch will signal */
+		uint64_t next_value = 1;
+		/* Cached so completed() can skip the driver when it can */
+		uint64_t known_completed = 0;
+		/* Values whose batch failed to submit. Later batches still
+		 * signal past them, so wait() has to check here first */
+		std::vector<uint64_t> failed_values;
+
+		std::vector<VkCommandBuffer> cmds;
+		std::vector<VkSemaphore> wait_sems;
+		std::vector<uint64_t> wait_values;
+		std::vector<VkPipelineStageFlags> wait_stages;
+		std::vector<VkSemaphore> signal_sems;
+		std::vector<uint64_t> signal_values;
+
+		void clear();
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocator = nullptr;
+	const Device_Dispatch* dispatch = nullptr;
+	std::mutex mutex;
+	std::vector<Queue_Batch> queues;
+	uint64_t submits = 0;
+
+	void add_wait(Queue_Batch& batch, VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stage);
+};
+#endif /* !SUBMIT_BATCHER_H */
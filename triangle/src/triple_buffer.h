@@ -0,0 +1,43 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+#include <atomic>
+#include <cstdint>
+
+/* Lock-free single producer/single consumer triple buffer.
+ *
+ * The writer always has a slot of its own to fill and the reader
+ * always has a slot of its own to look at, the third slot is swapped
+ * between them through one atomic. Neither side ever waits on the
+ * other, the reader just sees the newest complete value. */
+template <typename T>
+struct Triple_Buffer
+{
+	/* Writer side */
+	T& back() { return this->slots[this->back_index]; }
+	void publish()
+	{
+		uint8_t prev = this->middle.exchange(this->back_index | DIRTY_BIT, std::memory_order_acq_rel);
+		this->back_index = prev & INDEX_MASK;
+	}
+
+	/* Reader side. Returns true if a new value was picked up */
+	bool update()
+	{
+		if (!this->has_update()) return false;
+		uint8_t prev = this->middle.exchange(this->front_index, std::memory_order_acq_rel);
+		this->front_index = prev & INDEX_MASK;
+		return true;
+	}
+	bool has_update() const { return this->middle.load(std::memory_order_acquire) & DIRTY_BIT; }
+	const T& front() const { return this->slots[this->front_index]; }
+private:
+	static constexpr uint8_t DIRTY_BIT = 0x4;
+	static constexpr uint8_t INDEX_MASK = 0x3;
+
+	T slots[3] = {};
+	/* Only ever touched by their own side */
+	uint8_t back_index = 0;
+	uint8_t front_index = 1;
+	std::atomic<uint8_t> middle{2};
+};
+#endif /* !TRIPLE_BUFFER_H */
@@ -12,6 +12,9 @@
  */
 
 #include "vulkan_boilerplate.h"
+#include "frustum_cull.h"
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <fstream>
 
@@ -50,6 +53,8 @@ static std::vector<char> read_file(const std::string& filename)
 	std::vector<char> buffer(file_size);
 	file.seekg(0);
 	file.read(buffer.data(), file_size);
+
+	return buffer;
 }
 
 queue_family_indices_t find_queue_families(VkPhysicalDevice device, VkSurfaceKHR surface)
@@ -158,40 +163,6 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(
 	return VK_FALSE;
 }
 
-/* Load the vkCreateDebugUtilsMessengerEXT function
- * from it's extension, and then execute it */
-VkResult CreateDebugUtilsMessengerEXT(
-		VkInstance instance,
-		const VkDebugUtilsMessengerCreateInfoEXT* pcreateInfo,
-		const VkAllocationCallbacks* pAllocator,
-		VkDebugUtilsMessengerEXT* pDebugMessenger)
-{
-	auto func = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
-
-	if(func != nullptr)
-	{
-		return func(instance, pcreateInfo, pAllocator, pDebugMessenger);
-	}
-	else
-	{
-		return VK_ERROR_EXTENSION_NOT_PRESENT;
-	}
-}
-
-void DestroyDebugUtilsMessengerEXT(
-		VkInstance instance,
-		VkDebugUtilsMessengerEXT DebugMessenger,
-		const VkAllocationCallbacks* pAllocator)
-{
-	auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)
-		vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
-
-	if(func != nullptr)
-	{
-		func(instance, DebugMessenger, pAllocator);
-	}
-}
-
 /* Object Functions */
 bool queue_family_indices_t::is_complete()
 {
@@ -206,7 +177,7 @@ VkShaderModule Vk_Wrapper::create_shader_module(const std::vector<char>& code)
 	create_info.codeSize = code.size();
 	create_info.pCode = reinterpret_cast<const uint32_t*>(code.data());
 
-	if (vkCreateShaderModule(this->device, &create_info, nullptr, &shader_module)
+	if (vkCreateShaderModule(this->device, &create_info, this->allocator, &shader_module)
 	!= VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create shader module!");
@@ -215,6 +186,54 @@ VkShaderModule Vk_Wrapper::create_shader_module(const std::vector<char>& code)
 	return shader_module;
 }
 
+/* Finds a memory type that is allowed by type_filter (from
+ * VkMemoryRequirements) and has all of the requested properties */
+uint32_t Vk_Wrapper::find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties)
+{
+	VkPhysicalDeviceMemoryProperties mem_props;
+	vkGetPhysicalDeviceMemoryProperties(this->physical_device, &mem_props);
+
+	for (uint32_t i = 0; i < mem_props.memoryTypeCount; ++i)
+	{
+		if ((type_filter & (1 << i))
+				&& (mem_props.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("Failed to find a suitable memory type!");
+}
+
+
+void Vk_Wrapper::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
+		VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& memory)
+{
+	VkBufferCreateInfo buffer_info{};
+	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_info.size = size;
+	buffer_info.usage = usage;
+	buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(this->device, &buffer_info, this->allocator, &buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create buffer!");
+	}
+
+	VkMemoryRequirements mem_reqs;
+	vkGetBufferMemoryRequirements(this->device, buffer, &mem_reqs);
+
+	VkMemoryAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = mem_reqs.size;
+	alloc_info.memoryTypeIndex = find_memory_type(mem_reqs.memoryTypeBits, properties);
+
+	if (vkAllocateMemory(this->device, &alloc_info, this->allocator, &memory) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate buffer memory!");
+	}
+	vkBindBufferMemory(this->device, buffer, memory, 0);
+}
 
 VkExtent2D Vk_Wrapper::choose_swap_extent(const VkSurfaceCapabilitiesKHR& capabilities)
 {
@@ -249,7 +268,21 @@ bool Vk_Wrapper::device_is_suitable(VkPhysicalDevice device)
 		swap_chain_support_details_t sc_support = query_swap_chain_support(device);
 		swap_chain = !sc_support.formats.empty() && !sc_support.present_modes.empty();
 	}
-	return m_indices.is_complete() && extension_supported && swap_chain;
+	/* Vulkan 1.2 with timeline semaphores for the submission layer */
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(device, &props);
+	bool timeline = false;
+	if (props.apiVersion >= VK_API_VERSION_1_2)
+	{
+		VkPhysicalDeviceVulkan12Features features_12{};
+		features_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		VkPhysicalDeviceFeatures2 features{};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &features_12;
+		vkGetPhysicalDeviceFeatures2(device, &features);
+		timeline = features_12.timelineSemaphore;
+	}
+	return m_indices.is_complete() && extension_supported && swap_chain && timeline;
 }
 
 /* Queries device for it's supported swap chain formats and present modes */
@@ -315,15 +348,57 @@ VkPresentModeKHR Vk_Wrapper::pick_sc_present_format(const std::vector<VkPresentM
 
 void Vk_Wrapper::init()
 {
+	this->init_stages.clear();
+	this->init_mark = std::chrono::steady_clock::now();
+
 	this->init_window();
+	this->end_init_stage("init_window");
 	this->create_instance(); // Internal function to handle vulkan bookend
+	this->end_init_stage("create_instance");
 	this->setup_debug_messenger();
+	this->end_init_stage("setup_debug_messenger");
 	this->surface_init();
+	this->end_init_stage("surface_init");
 	this->pick_physical_device();
+	this->end_init_stage("pick_physical_device");
 	this->create_logical_device();
+	this->end_init_stage("create_logical_device");
+	this->deletion_queue.init(this->device, this->allocator);
+	this->submitter.init(this->device, this->allocator, &this->dispatch);
+	this->graphics_submit_id = this->submitter.add_queue(this->graphics_queue);
+	this->end_init_stage("submitter");
 	this->create_swap_chain();
+	this->end_init_stage("create_swap_chain");
 	this->create_image_views();
+	this->end_init_stage("create_image_views");
+	this->create_render_target();
+	this->end_init_stage("create_render_target");
+	this->create_depth_resources();
+	this->end_init_stage("create_depth_resources");
+	this->create_render_pass();
+	this->end_init_stage("create_render_pass");
 	this->create_graphics_pipeline();
+	this->end_init_stage("create_graphics_pipeline");
+	this->create_descriptor_layouts();
+	this->end_init_stage("create_descriptor_layouts");
+	this->create_mesh_pipeline();
+	this->end_init_stage("create_mesh_pipeline");
+	this->create_cull_pipelines();
+	this->end_init_stage("create_cull_pipelines");
+	this->create_depth_pyramid();
+	this->end_init_stage("create_depth_pyramid");
+	this->create_framebuffers();
+	this->end_init_stage("create_framebuffers");
+	this->create_command_pool();
+	this->end_init_stage("create_command_pool");
+	this->create_command_buffers();
+	this->end_init_stage("create_command_buffers");
+	this->create_sync_objects();
+	this->end_init_stage("create_sync_objects");
+	this->create_query_pool();
+	this->end_init_stage("create_query_pool");
+	this->create_capture_buffers();
+	this->end_init_stage("create_capture_buffers");
 }
 
 void Vk_Wrapper::surface_init()
@@ -331,7 +406,7 @@ void Vk_Wrapper::surface_init()
 	if (glfwCreateWindowSurface(
 		this->instance,
 		this->window,
-		nullptr,
+		this->allocator,
 		&this->surface
 		) != VK_SUCCESS)
 	{
@@ -339,31 +414,121 @@ void Vk_Wrapper::surface_init()
 	}
 }
 
+/* Closes the init stage started by the previous one */
+void Vk_Wrapper::end_init_stage(const char* name)
+{
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::duration<double, std::milli> elapsed = now - this->init_mark;
+	this->init_stages.push_back({name, elapsed.count()});
+	this->init_mark = now;
+}
+
 void Vk_Wrapper::init_window()
 {
-	glfwInit(); // Init GLFW
+#ifdef GLFW_PLATFORM_NULL
+	/* GLFW's null platform presents through VK_EXT_headless_surface,
+	 * so nothing needs a display server */
+	if (this->headless) glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
+	if (!glfwInit()) // Init GLFW
+	{
+		throw std::runtime_error("Failed to initialize GLFW");
+	}
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API); // Tell GLFW to not initialize an opengl context
 	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);   // Tell GLFW to not automatically resize the window
+	glfwWindowHint(GLFW_VISIBLE, this->headless ? GLFW_FALSE : GLFW_TRUE);
 	this->window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
 }
 
 void Vk_Wrapper::cleanup()
 {
-	vkDestroyPipelineLayout(this->device, this->pipe_layout, nullptr);
+	/* Let any frames in flight finish before tearing down */
+	vkDeviceWaitIdle(this->device);
+
+	this->capture.shutdown(this->device, this->allocator);
+	if (this->instance_count)
+	{
+		this->destroy_mesh(this->scene_mesh);
+		this->deletion_queue.retire(this->instance_buffer, this->frame_count);
+		this->deletion_queue.retire(this->instance_memory, this->frame_count);
+	}
+	for (auto& frame : this->cull_frames)
+	{
+		if (frame.draws == VK_NULL_HANDLE) continue;
+		this->deletion_queue.retire(frame.draws, this->frame_count);
+		this->deletion_queue.retire(frame.draws_memory, this->frame_count);
+		this->deletion_queue.retire(frame.count, this->frame_count);
+		this->deletion_queue.retire(frame.count_memory, this->frame_count);
+		this->deletion_queue.retire(frame.params, this->frame_count);
+		this->deletion_queue.retire(frame.params_memory, this->frame_count);
+	}
+	this->deletion_queue.flush();
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		vkDestroySemaphore(this->device, this->image_available_sems[i], this->allocator);
+		vkDestroySemaphore(this->device, this->render_finished_sems[i], this->allocator);
+	}
+	this->submitter.destroy();
+	if (this->timestamp_pool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(this->device, this->timestamp_pool, this->allocator);
+	}
+	vkDestroyCommandPool(this->device, this->command_pool, this->allocator);
+	vkDestroyFramebuffer(this->device, this->rt_framebuffer, this->allocator);
+	vkDestroyPipeline(this->device, this->graphics_pipeline, this->allocator);
+	for (VkPipeline variant : this->variant_pipelines)
+	{
+		vkDestroyPipeline(this->device, variant, this->allocator);
+	}
+	vkDestroyPipelineLayout(this->device, this->pipe_layout, this->allocator);
+	if (this->gpu_culling)
+	{
+		vkDestroyPipeline(this->device, this->cull_pipeline, this->allocator);
+		vkDestroyPipelineLayout(this->device, this->cull_layout, this->allocator);
+		vkDestroyPipeline(this->device, this->reduce_pipeline, this->allocator);
+		vkDestroyPipelineLayout(this->device, this->reduce_layout, this->allocator);
+		vkDestroyDescriptorSetLayout(this->device, this->cull_set_layout, this->allocator);
+		vkDestroyDescriptorSetLayout(this->device, this->reduce_set_layout, this->allocator);
+		vkDestroySampler(this->device, this->pyramid_sampler, this->allocator);
+		for (auto view : this->pyramid_mip_views)
+		{
+			vkDestroyImageView(this->device, view, this->allocator);
+		}
+		vkDestroyImageView(this->device, this->pyramid_view, this->allocator);
+		vkDestroyImage(this->device, this->pyramid_image, this->allocator);
+		vkFreeMemory(this->device, this->pyramid_memory, this->allocator);
+	}
+	vkDestroyPipeline(this->device, this->mesh_pipeline, this->allocator);
+	vkDestroyPipelineLayout(this->device, this->mesh_layout, this->allocator);
+	vkDestroyDescriptorSetLayout(this->device, this->mesh_set_layout, this->allocator);
+	vkDestroyDescriptorPool(this->device, this->descriptor_pool, this->allocator);
+	vkDestroyRenderPass(this->device, this->render_pass, this->allocator);
+	vkDestroyImageView(this->device, this->depth_view, this->allocator);
+	vkDestroyImage(this->device, this->depth_image, this->allocator);
+	vkFreeMemory(this->device, this->depth_memory, this->allocator);
+	vkDestroyImageView(this->device, this->rt_view, this->allocator);
+	vkDestroyImage(this->device, this->rt_image, this->allocator);
+	vkFreeMemory(this->device, this->rt_memory, this->allocator);
 	for (auto iv : this->sc_image_views)
 	{
-		vkDestroyImageView(this->device, iv, nullptr);
+		vkDestroyImageView(this->device, iv, this->allocator);
 	}
-	vkDestroySwapchainKHR(this->device, this->swap_chain, nullptr);
-	vkDestroyDevice(this->device, nullptr);
+	vkDestroySwapchainKHR(this->device, this->swap_chain, this->allocator);
+	vkDestroyDevice(this->device, this->allocator);
 	if(enable_validation_layers)
 	{
-		DestroyDebugUtilsMessengerEXT(this->instance, this->debugMessenger, nullptr);
+		this->instance_dispatch.DestroyDebugUtilsMessengerEXT(this->instance, this->debugMessenger, this->allocator);
 	}
-	vkDestroySurfaceKHR(this->instance, this->surface, nullptr);
+	vkDestroySurfaceKHR(this->instance, this->surface, this->allocator);
 	glfwDestroyWindow(this->window);
-	vkDestroyInstance(this->instance, nullptr);
+	vkDestroyInstance(this->instance, this->allocator);
 	glfwTerminate();
+
+	if (enable_validation_layers)
+	{
+		this->host_alloc.report(std::cout);
+	}
 }
 
 void Vk_Wrapper::create_instance()
@@ -407,11 +572,13 @@ void Vk_Wrapper::create_instance()
 	}
 
 	/* Finally the vulkan instance creation */
-	VkResult result = vkCreateInstance(&create_info, nullptr, &this->instance);
+	VkResult result = vkCreateInstance(&create_info, this->allocator, &this->instance);
 	if(result != VK_SUCCESS)
 	{
 		throw std::runtime_error("failed to create vk instance!");
 	}
+	/* Extension functions get looked up once, here */
+	this->instance_dispatch.load(this->instance);
 }
 
 /* Tells vulkan validation layers where and when
@@ -424,7 +591,9 @@ void Vk_Wrapper::setup_debug_messenger()
 
 	populate_dbg_msgr_create_info(create_info);
 
-	if (CreateDebugUtilsMessengerEXT(this->instance, &create_info, nullptr, &this->debugMessenger) != VK_SUCCESS)
+	if (!this->instance_dispatch.CreateDebugUtilsMessengerEXT
+			|| this->instance_dispatch.CreateDebugUtilsMessengerEXT(this->instance, &create_info,
+				this->allocator, &this->debugMessenger) != VK_SUCCESS)
 	{
 		throw std::runtime_error("failed to setup debug messenger!");
 	}
@@ -452,12 +621,54 @@ void Vk_Wrapper::create_logical_device()
 		queue_create_infos.push_back(queue_create_info);
 	}
 
+	/* GPU culling writes one indirect draw per visible instance, with
+	 * the instance index in firstInstance and the count on the GPU,
+	 * and builds its depth pyramid by sampling scene depth. All of
+	 * it is optional, without it the scene is drawn unculled */
+	VkPhysicalDeviceVulkan12Features supported_12{};
+	supported_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 supported{};
+	supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supported.pNext = &supported_12;
+	vkGetPhysicalDeviceFeatures2(this->physical_device, &supported);
+
+	uint32_t family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(this->physical_device, &family_count, nullptr);
+	std::vector<VkQueueFamilyProperties> families(family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(this->physical_device, &family_count, families.data());
+	bool graphics_compute = families[indices.graphics_family.value()].queueFlags & VK_QUEUE_COMPUTE_BIT;
+
+	VkFormatProperties depth_props;
+	vkGetPhysicalDeviceFormatProperties(this->physical_device, VK_FORMAT_D32_SFLOAT, &depth_props);
+	bool depth_sampled = depth_props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+
+	/* Checked against the scene's instance count in load_scene */
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(this->physical_device, &props);
+	this->max_draw_indirect_count = props.limits.maxDrawIndirectCount;
+
+	this->gpu_culling = supported.features.drawIndirectFirstInstance
+		&& supported.features.multiDrawIndirect
+		&& supported_12.drawIndirectCount && graphics_compute && depth_sampled;
+	if (!this->gpu_culling)
+	{
+		std::cerr << "Indirect count draws unsupported, GPU culling disabled" << std::endl;
+	}
+
 	// Device feature struct, linked in the device_create_info struct below
-	// For now we just want to instance the lib so no feature requests
 	VkPhysicalDeviceFeatures device_features{};
+	device_features.drawIndirectFirstInstance = this->gpu_culling;
+	device_features.multiDrawIndirect = this->gpu_culling;
+
+	/* Timeline semaphores back all of Submit_Batcher */
+	VkPhysicalDeviceVulkan12Features features_12{};
+	features_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	features_12.timelineSemaphore = VK_TRUE;
+	features_12.drawIndirectCount = this->gpu_culling;
 
 	VkDeviceCreateInfo device_create_info{};
 	device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	device_create_info.pNext = &features_12;
 	device_create_info.queueCreateInfoCount = static_cast<uint32_t>(queue_create_infos.size());
 	device_create_info.pQueueCreateInfos = queue_create_infos.data();
 	device_create_info.pEnabledFeatures = &device_features;
@@ -473,12 +684,19 @@ void Vk_Wrapper::create_logical_device()
 		device_create_info.enabledLayerCount = 0;
 	}
 
-	if(vkCreateDevice(this->physical_device, &device_create_info, nullptr, &this->device) !=VK_SUCCESS)
+	if(vkCreateDevice(this->physical_device, &device_create_info, this->allocator, &this->device) !=VK_SUCCESS)
 	{
 		throw std::runtime_error("failed to create logical device");
 	}
+	this->dispatch.load(this->device);
+	/* Optional in the table, but this device was made with VK_KHR_swapchain */
+	if (!this->dispatch.AcquireNextImageKHR || !this->dispatch.QueuePresentKHR)
+	{
+		throw std::runtime_error("failed to load swap chain functions");
+	}
 
-	vkGetDeviceQueue(this->device, indices.present_family.value(), 0, &this->graphics_queue);
+	this->indices = indices;
+	vkGetDeviceQueue(this->device, indices.graphics_family.value(), 0, &this->graphics_queue);
 	vkGetDeviceQueue(this->device, indices.present_family.value(), 0, &this->present_queue);
 }
 
@@ -553,7 +771,11 @@ void Vk_Wrapper::create_swap_chain()
 	create_info.imageColorSpace = surface_fmt.colorSpace;
 	create_info.imageExtent = extent;
 	create_info.imageArrayLayers = 1;
-	create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	/* We never render to the swap chain directly, the internal
+	 * render target gets blitted onto it at the end of the frame */
+	create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+		| VK_IMAGE_USAGE_TRANSFER_DST_BIT
+		| VK_IMAGE_USAGE_TRANSFER_SRC_BIT; // Frame capture readback
 
 	/* Handle potentially differing graphics and presentation queues */
 	queue_family_indices_t indices = find_queue_families(this->physical_device, this->surface);
@@ -575,10 +797,11 @@ void Vk_Wrapper::create_swap_chain()
 	create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	create_info.presentMode = present_mode;
 	create_info.clipped = VK_TRUE;
-	create_info.oldSwapchain = VK_NULL_HANDLE;
+	/* Null at init, the one being replaced on recreation */
+	create_info.oldSwapchain = this->swap_chain;
 	
 	/* Actually create the swap chain */
-	if (vkCreateSwapchainKHR(this->device, &create_info, nullptr, &this->swap_chain)
+	if (vkCreateSwapchainKHR(this->device, &create_info, this->allocator, &this->swap_chain)
 			!= VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create swap chain");
@@ -592,6 +815,43 @@ void Vk_Wrapper::create_swap_chain()
 	this->sc_extent = extent;
 }
 
+/* The window can't be resized, so an out of date swap chain comes
+ * from minimizing or a mode switch and is recreated at the same size
+ * and format. Everything sized from it (render target, depth, depth
+ * pyramid, capture buffers) is kept, so a swap chain that really did
+ * change is an error rather than something to limp along with */
+void Vk_Wrapper::recreate_swap_chain()
+{
+	/* Minimized, nothing can be presented until it's back */
+	int width = 0, height = 0;
+	glfwGetFramebufferSize(this->window, &width, &height);
+	while ((width == 0 || height == 0) && !glfwWindowShouldClose(this->window))
+	{
+		glfwWaitEvents();
+		glfwGetFramebufferSize(this->window, &width, &height);
+	}
+	if (glfwWindowShouldClose(this->window)) return;
+
+	vkDeviceWaitIdle(this->device);
+	VkExtent2D old_extent = this->sc_extent;
+	VkFormat old_fmt = this->sc_image_fmt;
+	VkSwapchainKHR old_swap_chain = this->swap_chain;
+	for (auto iv : this->sc_image_views)
+	{
+		vkDestroyImageView(this->device, iv, this->allocator);
+	}
+	this->create_swap_chain();
+	vkDestroySwapchainKHR(this->device, old_swap_chain, this->allocator);
+	this->create_image_views();
+	this->sc_out_of_date = false;
+
+	if (this->sc_extent.width != old_extent.width || this->sc_extent.height != old_extent.height
+			|| this->sc_image_fmt != old_fmt)
+	{
+		throw std::runtime_error("swap chain changed size or format!");
+	}
+}
+
 void Vk_Wrapper::create_image_views()
 {
 	this->sc_image_views.resize(this->sc_images.size());
@@ -613,7 +873,7 @@ void Vk_Wrapper::create_image_views()
 		create_info.subresourceRange.baseArrayLayer = 0;
 		create_info.subresourceRange.layerCount = 1;
 
-		if (vkCreateImageView(this->device, &create_info, nullptr, &this->sc_image_views[i])
+		if (vkCreateImageView(this->device, &create_info, this->allocator, &this->sc_image_views[i])
 		!= VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create image views!");
@@ -723,7 +983,13 @@ void Vk_Wrapper::create_graphics_pipeline()
 	multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
 	multisampling.alphaToOneEnable = VK_FALSE; // Optional
 
-	/* Depth and Stencil testing, no struct here for now */
+	/* Depth and Stencil testing, the triangle sits behind
+	 * everything so it neither tests nor writes */
+	VkPipelineDepthStencilStateCreateInfo depth_stencil{};
+	depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depth_stencil.depthTestEnable = VK_FALSE;
+	depth_stencil.depthWriteEnable = VK_FALSE;
+	depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
 
 	/* Color blending, Takes fragment shader color and blends
 	 * it to the already existing color.
@@ -755,27 +1021,1485 @@ void Vk_Wrapper::create_graphics_pipeline()
 	color_blending.blendConstants[3] = 0.0f; // Optional
 	
 	/* Dynamic state, allows for limited mutable modification
-	 * of the otherwise immutable pipeline. */
+	 * of the otherwise immutable pipeline.
+	 * Viewport and scissor change every frame with the
+	 * dynamic resolution scale. */
 	VkDynamicState dynamic_states[] = {
 	    VK_DYNAMIC_STATE_VIEWPORT,
+	    VK_DYNAMIC_STATE_SCISSOR,
 	    VK_DYNAMIC_STATE_LINE_WIDTH
 	};
 	
 	VkPipelineDynamicStateCreateInfo dynamic_state{};
 	dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	dynamic_state.dynamicStateCount = 2;
+	dynamic_state.dynamicStateCount = sizeof(dynamic_states) / sizeof(dynamic_states[0]);
 	dynamic_state.pDynamicStates = dynamic_states;
 
-	/* Pipeline layout */
+	/* Pipeline layout, the scene transform goes in as a push constant */
+	VkPushConstantRange scene_range{};
+	scene_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	scene_range.offset = 0;
+	scene_range.size = sizeof(Scene_Params);
+
 	VkPipelineLayoutCreateInfo pipeline_layout_info{};
 	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipeline_layout_info.setLayoutCount = 0; // Optional
 	pipeline_layout_info.pSetLayouts = nullptr; // Optional
-	pipeline_layout_info.pushConstantRangeCount = 0; // Optional
-	pipeline_layout_info.pPushConstantRanges = nullptr; // Optional
+	pipeline_layout_info.pushConstantRangeCount = 1;
+	pipeline_layout_info.pPushConstantRanges = &scene_range;
 
-	if (vkCreatePipelineLayout(this->device, &pipeline_layout_info, nullptr, &this->pipe_layout)
+	if (vkCreatePipelineLayout(this->device, &pipeline_layout_info, this->allocator, &this->pipe_layout)
 			!= VK_SUCCESS) {
 		throw std::runtime_error("failed to create pipeline layout!");
 	}
+
+	/* And finally the pipeline itself */
+	VkGraphicsPipelineCreateInfo pipeline_info{};
+	pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipeline_info.stageCount = 2;
+	pipeline_info.pStages = shader_stages;
+	pipeline_info.pVertexInputState = &vertex_info;
+	pipeline_info.pInputAssemblyState = &input_asm;
+	pipeline_info.pViewportState = &viewport_state;
+	pipeline_info.pRasterizationState = &rasterizer;
+	pipeline_info.pMultisampleState = &multisampling;
+	pipeline_info.pDepthStencilState = &depth_stencil;
+	pipeline_info.pColorBlendState = &color_blending;
+	pipeline_info.pDynamicState = &dynamic_state;
+	pipeline_info.layout = this->pipe_layout;
+	pipeline_info.renderPass = this->render_pass;
+	pipeline_info.subpass = 0;
+	pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+
+	if (vkCreateGraphicsPipelines(this->device, VK_NULL_HANDLE, 1, &pipeline_info, this->allocator,
+				&this->graphics_pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create graphics pipeline!");
+	}
+
+	/* Variants only change the depth bias, which does nothing with
+	 * depth testing off, but every one is its own pipeline object */
+	if (this->extra_pipelines)
+	{
+		std::vector<VkPipelineRasterizationStateCreateInfo> variant_rasterizers(this->extra_pipelines, rasterizer);
+		std::vector<VkGraphicsPipelineCreateInfo> variant_infos(this->extra_pipelines, pipeline_info);
+		for (uint32_t i = 0; i < this->extra_pipelines; ++i)
+		{
+			variant_rasterizers[i].depthBiasEnable = VK_TRUE;
+			variant_rasterizers[i].depthBiasConstantFactor = (float) (i + 1);
+			variant_infos[i].pRasterizationState = &variant_rasterizers[i];
+		}
+
+		this->variant_pipelines.resize(this->extra_pipelines);
+		if (vkCreateGraphicsPipelines(this->device, VK_NULL_HANDLE, this->extra_pipelines, variant_infos.data(),
+					this->allocator, this->variant_pipelines.data()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create graphics pipeline variants!");
+		}
+	}
+
+	/* Modules are baked into the pipeline now */
+	vkDestroyShaderModule(this->device, frag_sm, this->allocator);
+	vkDestroyShaderModule(this->device, vert_sm, this->allocator);
+}
+
+/* Offscreen colour target that the scene is actually drawn into.
+ * Allocated once at the swap chain extent, the dynamic resolution
+ * scale only changes how much of it gets used. */
+void Vk_Wrapper::create_render_target()
+{
+	/* The final blit needs the swap chain format to be a blit destination */
+	VkFormatProperties fmt_props;
+	vkGetPhysicalDeviceFormatProperties(this->physical_device, this->sc_image_fmt, &fmt_props);
+	if (!(fmt_props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT)
+			|| !(fmt_props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT))
+	{
+		throw std::runtime_error("Swap chain format does not support blitting!");
+	}
+
+	VkImageCreateInfo image_info{};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.format = this->sc_image_fmt;
+	image_info.extent.width = this->sc_extent.width;
+	image_info.extent.height = this->sc_extent.height;
+	image_info.extent.depth = 1;
+	image_info.mipLevels = 1;
+	image_info.arrayLayers = 1;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(this->device, &image_info, this->allocator, &this->rt_image) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create render target image!");
+	}
+
+	VkMemoryRequirements mem_reqs;
+	vkGetImageMemoryRequirements(this->device, this->rt_image, &mem_reqs);
+
+	VkMemoryAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = mem_reqs.size;
+	alloc_info.memoryTypeIndex = find_memory_type(mem_reqs.memoryTypeBits,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(this->device, &alloc_info, this->allocator, &this->rt_memory) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate render target memory!");
+	}
+	vkBindImageMemory(this->device, this->rt_image, this->rt_memory, 0);
+
+	VkImageViewCreateInfo view_info{};
+	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image = this->rt_image;
+	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format = this->sc_image_fmt;
+	view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	view_info.subresourceRange.baseMipLevel = 0;
+	view_info.subresourceRange.levelCount = 1;
+	view_info.subresourceRange.baseArrayLayer = 0;
+	view_info.subresourceRange.layerCount = 1;
+
+	if (vkCreateImageView(this->device, &view_info, this->allocator, &this->rt_view) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create render target view!");
+	}
+}
+
+void Vk_Wrapper::create_render_pass()
+{
+	/* Single colour attachment, left ready to be blitted from */
+	VkAttachmentDescription color_att{};
+	color_att.format = this->sc_image_fmt;
+	color_att.samples = VK_SAMPLE_COUNT_1_BIT;
+	color_att.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	color_att.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	color_att.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	color_att.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	color_att.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	color_att.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+	/* Depth, kept and left ready for the depth pyramid pass. It
+	 * isn't sampled without GPU culling, so it stays an attachment */
+	VkAttachmentDescription depth_att{};
+	depth_att.format = VK_FORMAT_D32_SFLOAT;
+	depth_att.samples = VK_SAMPLE_COUNT_1_BIT;
+	depth_att.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depth_att.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depth_att.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depth_att.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depth_att.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depth_att.finalLayout = this->gpu_culling
+		? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		: VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference color_ref{};
+	color_ref.attachment = 0;
+	color_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference depth_ref{};
+	depth_ref.attachment = 1;
+	depth_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpass{};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &color_ref;
+	subpass.pDepthStencilAttachment = &depth_ref;
+
+	/* The previous frame's blit reads the same image, so wait on it
+	 * before clearing, and make our writes visible to this frame's blit.
+	 * Depth is the same story with the depth pyramid pass */
+	VkSubpassDependency deps[2]{};
+	deps[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	deps[0].dstSubpass = 0;
+	deps[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	deps[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	deps[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		| VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	deps[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	deps[1].srcSubpass = 0;
+	deps[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	deps[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		| VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	deps[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	deps[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	deps[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+	VkAttachmentDescription attachments[] = {color_att, depth_att};
+
+	VkRenderPassCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	create_info.attachmentCount = 2;
+	create_info.pAttachments = attachments;
+	create_info.subpassCount = 1;
+	create_info.pSubpasses = &subpass;
+	create_info.dependencyCount = 2;
+	create_info.pDependencies = deps;
+
+	if (vkCreateRenderPass(this->device, &create_info, this->allocator, &this->render_pass) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create render pass!");
+	}
+}
+
+/* Only the internal render target needs a framebuffer,
+ * the swap chain images are just blit destinations */
+void Vk_Wrapper::create_framebuffers()
+{
+	VkFramebufferCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	create_info.renderPass = this->render_pass;
+	VkImageView attachments[] = {this->rt_view, this->depth_view};
+	create_info.attachmentCount = 2;
+	create_info.pAttachments = attachments;
+	create_info.width = this->sc_extent.width;
+	create_info.height = this->sc_extent.height;
+	create_info.layers = 1;
+
+	if (vkCreateFramebuffer(this->device, &create_info, this->allocator, &this->rt_framebuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create framebuffer!");
+	}
+}
+
+void Vk_Wrapper::create_command_pool()
+{
+	VkCommandPoolCreateInfo pool_info{};
+	pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	pool_info.queueFamilyIndex = this->indices.graphics_family.value();
+
+	if (vkCreateCommandPool(this->device, &pool_info, this->allocator, &this->command_pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create command pool!");
+	}
+}
+
+void Vk_Wrapper::create_command_buffers()
+{
+	this->command_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+
+	VkCommandBufferAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	alloc_info.commandPool = this->command_pool;
+	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	alloc_info.commandBufferCount = static_cast<uint32_t>(this->command_buffers.size());
+
+	if (vkAllocateCommandBuffers(this->device, &alloc_info, this->command_buffers.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate command buffers!");
+	}
+}
+
+void Vk_Wrapper::create_sync_objects()
+{
+	this->image_available_sems.resize(MAX_FRAMES_IN_FLIGHT);
+	this->render_finished_sems.resize(MAX_FRAMES_IN_FLIGHT);
+
+	/* Binary semaphores for the swap chain only, frame pacing on
+	 * the CPU goes through the graphics timeline in submitter */
+	VkSemaphoreCreateInfo sem_info{};
+	sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		if (vkCreateSemaphore(this->device, &sem_info, this->allocator, &this->image_available_sems[i]) != VK_SUCCESS
+				|| vkCreateSemaphore(this->device, &sem_info, this->allocator, &this->render_finished_sems[i]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create sync objects!");
+		}
+	}
+}
+
+/* Timestamp queries feeding the dynamic resolution controller.
+ * If the graphics queue can't do timestamps we just stay at full
+ * resolution. */
+void Vk_Wrapper::create_query_pool()
+{
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(this->physical_device, &props);
+
+	uint32_t family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(this->physical_device, &family_count, nullptr);
+	std::vector<VkQueueFamilyProperties> families(family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(this->physical_device, &family_count, families.data());
+
+	if (families[this->indices.graphics_family.value()].timestampValidBits == 0
+			|| props.limits.timestampPeriod == 0.0f)
+	{
+		std::cerr << "GPU timestamps unsupported, dynamic resolution disabled" << std::endl;
+		return;
+	}
+	this->timestamp_period = props.limits.timestampPeriod;
+
+	VkQueryPoolCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	create_info.queryCount = 2 * MAX_FRAMES_IN_FLIGHT;
+
+	if (vkCreateQueryPool(this->device, &create_info, this->allocator, &this->timestamp_pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create timestamp query pool!");
+	}
+}
+
+/* Only call once the frame's timeline value has been waited on,
+ * the results are then guaranteed to be available */
+float Vk_Wrapper::read_gpu_frame_time(size_t frame)
+{
+	if (this->timestamp_pool == VK_NULL_HANDLE || !this->timestamps_pending[frame]) return 0.0f;
+
+	uint64_t stamps[2];
+	VkResult result = this->dispatch.GetQueryPoolResults(this->device, this->timestamp_pool,
+			static_cast<uint32_t>(frame * 2), 2, sizeof(stamps), stamps, sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT);
+	this->timestamps_pending[frame] = false;
+	if (result != VK_SUCCESS) return 0.0f;
+
+	return (stamps[1] - stamps[0]) * this->timestamp_period / 1000000.0f;
+}
+
+void Vk_Wrapper::record_command_buffer(VkCommandBuffer cmd, uint32_t image_index)
+{
+	VkCommandBufferBeginInfo begin_info{};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (this->dispatch.BeginCommandBuffer(cmd, &begin_info) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to begin recording command buffer!");
+	}
+
+	uint32_t query = static_cast<uint32_t>(this->current_frame * 2);
+	if (this->timestamp_pool != VK_NULL_HANDLE)
+	{
+		this->dispatch.CmdResetQueryPool(cmd, this->timestamp_pool, query, 2);
+		this->dispatch.CmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, this->timestamp_pool, query);
+	}
+
+	this->record_cull(cmd);
+
+	/* Scene pass, drawn at the scaled resolution */
+	VkExtent2D render_extent = this->dyn_res.scaled_extent(this->sc_extent);
+
+	VkClearValue clear_values[2]{};
+	clear_values[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+	clear_values[1].depthStencil = {1.0f, 0};
+	VkRenderPassBeginInfo rp_info{};
+	rp_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	rp_info.renderPass = this->render_pass;
+	rp_info.framebuffer = this->rt_framebuffer;
+	rp_info.renderArea.offset = {0, 0};
+	rp_info.renderArea.extent = render_extent;
+	rp_info.clearValueCount = 2;
+	rp_info.pClearValues = clear_values;
+
+	this->dispatch.CmdBeginRenderPass(cmd, &rp_info, VK_SUBPASS_CONTENTS_INLINE);
+
+	VkViewport viewport{};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float) render_extent.width;
+	viewport.height = (float) render_extent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	this->dispatch.CmdSetViewport(cmd, 0, 1, &viewport);
+
+	VkRect2D scissor{};
+	scissor.offset = {0, 0};
+	scissor.extent = render_extent;
+	this->dispatch.CmdSetScissor(cmd, 0, 1, &scissor);
+
+	this->dispatch.CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->graphics_pipeline);
+	this->dispatch.CmdPushConstants(cmd, this->pipe_layout, VK_SHADER_STAGE_VERTEX_BIT,
+			0, sizeof(Scene_Params), &this->scene);
+	this->dispatch.CmdDraw(cmd, 3, 1, 0, 0);
+	/* Same layout, so the push constants carry over */
+	for (VkPipeline variant : this->variant_pipelines)
+	{
+		this->dispatch.CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, variant);
+		this->dispatch.CmdDraw(cmd, 3, 1, 0, 0);
+	}
+
+	this->record_mesh_draw(cmd);
+
+	this->dispatch.CmdEndRenderPass(cmd);
+
+	this->record_depth_pyramid(cmd, render_extent);
+
+	/* Upscale pass, stretch the used corner of the render target
+	 * over the whole swap chain image */
+	VkImageMemoryBarrier to_dst{};
+	to_dst.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	to_dst.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	to_dst.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	to_dst.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	to_dst.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	to_dst.image = this->sc_images[image_index];
+	to_dst.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+	to_dst.srcAccessMask = 0;
+	to_dst.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	this->dispatch.CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &to_dst);
+
+	VkImageBlit blit{};
+	blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+	blit.srcOffsets[1] = {(int32_t) render_extent.width, (int32_t) render_extent.height, 1};
+	blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+	blit.dstOffsets[1] = {(int32_t) this->sc_extent.width, (int32_t) this->sc_extent.height, 1};
+	this->dispatch.CmdBlitImage(cmd,
+			this->rt_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			this->sc_images[image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1, &blit, VK_FILTER_LINEAR);
+
+	VkImageMemoryBarrier to_present = to_dst;
+	to_present.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	to_present.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	to_present.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	to_present.dstAccessMask = 0;
+
+	/* Frame capture, a single copy into the readback ring. The encoder
+	 * thread picks it up once this frame's timeline value has passed. */
+	int capture_slot = this->capture.acquire_slot(this->current_frame);
+	if (capture_slot >= 0)
+	{
+		VkImageMemoryBarrier to_src = to_dst;
+		to_src.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		to_src.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		to_src.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		to_src.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		this->dispatch.CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				0, 0, nullptr, 0, nullptr, 1, &to_src);
+
+		this->capture.record_copy(cmd, capture_slot, this->sc_images[image_index], this->sc_extent);
+
+		to_present.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		to_present.srcAccessMask = 0;
+	}
+	this->dispatch.CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &to_present);
+
+	if (this->timestamp_pool != VK_NULL_HANDLE)
+	{
+		this->dispatch.CmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, this->timestamp_pool, query + 1);
+		this->timestamps_pending[this->current_frame] = true;
+	}
+
+	if (this->dispatch.EndCommandBuffer(cmd) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record command buffer!");
+	}
+}
+
+void Vk_Wrapper::draw_frame()
+{
+	size_t frame = this->current_frame;
+	uint64_t allocs_before = this->host_alloc.total_allocs();
+	this->submitter.wait(this->graphics_submit_id, this->slot_timeline[frame]);
+
+	/* Whatever this slot submitted last time round is now done */
+	this->completed_frame = std::max(this->completed_frame, this->slot_frame[frame]);
+	this->deletion_queue.collect(this->completed_frame);
+
+	/* An out of date swap chain stays that way until it's recreated.
+	 * The frame that finds out is skipped before anything else moves,
+	 * nothing was signalled and the slot is left as it was */
+	if (this->sc_out_of_date) this->recreate_swap_chain();
+	uint32_t image_index;
+	VkResult acquired = this->dispatch.AcquireNextImageKHR(this->device, this->swap_chain, UINT64_MAX,
+			this->image_available_sems[frame], VK_NULL_HANDLE, &image_index);
+	if (acquired == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		this->sc_out_of_date = true;
+		return;
+	}
+	if (acquired != VK_SUCCESS && acquired != VK_SUBOPTIMAL_KHR)
+	{
+		throw std::runtime_error("failed to acquire swap chain image!");
+	}
+	/* Still usable, replace it after this frame */
+	if (acquired == VK_SUBOPTIMAL_KHR) this->sc_out_of_date = true;
+
+	/* This slot's previous frame is done, so its timestamps are ready
+	 * without stalling. They are MAX_FRAMES_IN_FLIGHT frames old,
+	 * which is fine for a controller that reacts over several frames. */
+	this->dyn_res.update(this->read_gpu_frame_time(frame));
+	this->capture.frame_retired(frame);
+
+	VkCommandBuffer cmd = this->command_buffers[frame];
+	this->dispatch.ResetCommandBuffer(cmd, 0);
+	this->record_command_buffer(cmd, image_index);
+
+	/* Anything else enqueued on the graphics queue this frame
+	 * goes out in the same vkQueueSubmit */
+	uint32_t gfx = this->graphics_submit_id;
+	this->submitter.wait_binary(gfx, this->image_available_sems[frame], VK_PIPELINE_STAGE_TRANSFER_BIT);
+	this->slot_timeline[frame] = this->submitter.enqueue(gfx, cmd);
+	this->submitter.signal_binary(gfx, this->render_finished_sems[frame]);
+	this->submitter.flush();
+	this->slot_frame[frame] = ++this->frame_count;
+
+	VkPresentInfoKHR present_info{};
+	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	present_info.waitSemaphoreCount = 1;
+	present_info.pWaitSemaphores = &this->render_finished_sems[frame];
+	present_info.swapchainCount = 1;
+	present_info.pSwapchains = &this->swap_chain;
+	present_info.pImageIndices = &image_index;
+
+	/* The frame is submitted either way, an out of date or suboptimal
+	 * swap chain is recreated before the next acquire */
+	VkResult presented = this->dispatch.QueuePresentKHR(this->present_queue, &present_info);
+	if (presented == VK_SUBOPTIMAL_KHR || presented == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		this->sc_out_of_date = true;
+	} else if (presented != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to present swap chain image!");
+	}
+
+	this->current_frame = (this->current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+	this->frame_host_allocs = this->host_alloc.total_allocs() - allocs_before;
+}
+
+/* Host visible readback ring for Frame_Capture, sized for a full
+ * swap chain image at 4 bytes per pixel */
+void Vk_Wrapper::create_capture_buffers()
+{
+	/* Nothing to read back into if the format can't be captured */
+	if (!Frame_Capture::format_supported(this->sc_image_fmt))
+	{
+		this->capture.start(MAX_FRAMES_IN_FLIGHT, this->sc_image_fmt, &this->dispatch);
+		return;
+	}
+
+	VkDeviceSize size = (VkDeviceSize) this->sc_extent.width * this->sc_extent.height
+		* CAPTURE_BYTES_PER_PIXEL;
+
+	for (int i = 0; i < CAPTURE_RING_SIZE; ++i)
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory;
+		/* Cached memory makes the encoder's reads far cheaper,
+		 * fall back to plain coherent memory if there is none */
+		try {
+			create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+					| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+					| VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+					buffer, memory);
+		} catch (std::exception&) {
+			vkDestroyBuffer(this->device, buffer, this->allocator);
+			create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+					| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					buffer, memory);
+		}
+
+		void* mapped;
+		vkMapMemory(this->device, memory, 0, size, 0, &mapped);
+		this->capture.add_slot(buffer, memory, mapped);
+	}
+
+	this->capture.start(MAX_FRAMES_IN_FLIGHT, this->sc_image_fmt, &this->dispatch);
+}
+
+/* One staging buffer for all three sections, filled straight from
+ * the file mapping. The copy is a one off on the graphics queue and
+ * we wait for it here, loading isn't on the frame path */
+Gpu_Mesh Vk_Wrapper::upload_mesh(const Mesh_File& file)
+{
+	/* Zero sized vertex or index buffers are invalid, and there'd be nothing to draw */
+	if (file.header().vertex_count == 0 || file.header().index_count == 0)
+	{
+		throw std::runtime_error("Mesh has no vertices or indices!");
+	}
+
+	Gpu_Mesh mesh;
+	mesh.header = file.header();
+	mesh.index_type = mesh.header.index_size == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+	VkDeviceSize vertex_bytes = file.vertex_bytes();
+	VkDeviceSize index_bytes = file.index_bytes();
+	VkDeviceSize meshlet_bytes = file.meshlet_bytes();
+	/* Zero sized buffers are invalid, an empty meshlet section still gets one */
+	VkDeviceSize meshlet_size = meshlet_bytes ? meshlet_bytes : sizeof(Meshlet);
+
+	VkBuffer staging;
+	VkDeviceMemory staging_memory;
+	create_buffer(vertex_bytes + index_bytes + meshlet_bytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			staging, staging_memory);
+
+	char* mapped;
+	vkMapMemory(this->device, staging_memory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>(&mapped));
+	memcpy(mapped, file.vertices(), vertex_bytes);
+	memcpy(mapped + vertex_bytes, file.indices(), index_bytes);
+	memcpy(mapped + vertex_bytes + index_bytes, file.meshlets(), meshlet_bytes);
+	vkUnmapMemory(this->device, staging_memory);
+
+	create_buffer(vertex_bytes,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+			| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.vertex_buffer, mesh.vertex_memory);
+	create_buffer(index_bytes,
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+			| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.index_buffer, mesh.index_memory);
+	create_buffer(meshlet_size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.meshlet_buffer, mesh.meshlet_memory);
+
+	VkCommandBufferAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	alloc_info.commandPool = this->command_pool;
+	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	alloc_info.commandBufferCount = 1;
+
+	VkCommandBuffer cmd;
+	if (vkAllocateCommandBuffers(this->device, &alloc_info, &cmd) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate upload command buffer!");
+	}
+
+	VkCommandBufferBeginInfo begin_info{};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	this->dispatch.BeginCommandBuffer(cmd, &begin_info);
+
+	VkBufferCopy region{};
+	region.srcOffset = 0;
+	region.size = vertex_bytes;
+	this->dispatch.CmdCopyBuffer(cmd, staging, mesh.vertex_buffer, 1, &region);
+	region.srcOffset = vertex_bytes;
+	region.size = index_bytes;
+	this->dispatch.CmdCopyBuffer(cmd, staging, mesh.index_buffer, 1, &region);
+	if (meshlet_bytes)
+	{
+		region.srcOffset = vertex_bytes + index_bytes;
+		region.size = meshlet_bytes;
+		this->dispatch.CmdCopyBuffer(cmd, staging, mesh.meshlet_buffer, 1, &region);
+	}
+
+	/* Make the copies visible to everything that reads the buffers */
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT
+		| VK_ACCESS_SHADER_READ_BIT;
+	this->dispatch.CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+			| VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	if (this->dispatch.EndCommandBuffer(cmd) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record upload command buffer!");
+	}
+
+	uint64_t value = this->submitter.enqueue(this->graphics_submit_id, cmd);
+	this->submitter.flush();
+	this->submitter.wait(this->graphics_submit_id, value);
+
+	vkFreeCommandBuffers(this->device, this->command_pool, 1, &cmd);
+	vkDestroyBuffer(this->device, staging, this->allocator);
+	vkFreeMemory(this->device, staging_memory, this->allocator);
+
+	return mesh;
+}
+
+/* Frames already submitted may still draw from the buffers */
+void Vk_Wrapper::destroy_mesh(Gpu_Mesh& mesh)
+{
+	uint64_t last_use = this->submitted_frames();
+	this->deletion_queue.retire(mesh.vertex_buffer, last_use);
+	this->deletion_queue.retire(mesh.index_buffer, last_use);
+	this->deletion_queue.retire(mesh.meshlet_buffer, last_use);
+	this->deletion_queue.retire(mesh.vertex_memory, last_use);
+	this->deletion_queue.retire(mesh.index_memory, last_use);
+	this->deletion_queue.retire(mesh.meshlet_memory, last_use);
+	mesh = Gpu_Mesh{};
+}
+
+void Vk_Wrapper::create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspect,
+		uint32_t base_mip, uint32_t mip_count, VkImageView& view)
+{
+	VkImageViewCreateInfo view_info{};
+	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image = image;
+	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format = format;
+	view_info.subresourceRange.aspectMask = aspect;
+	view_info.subresourceRange.baseMipLevel = base_mip;
+	view_info.subresourceRange.levelCount = mip_count;
+	view_info.subresourceRange.baseArrayLayer = 0;
+	view_info.subresourceRange.layerCount = 1;
+
+	if (vkCreateImageView(this->device, &view_info, this->allocator, &view) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create image view!");
+	}
+}
+
+/* Full extent like the render target, dynamic resolution only
+ * uses the top left corner of it */
+void Vk_Wrapper::create_depth_resources()
+{
+	/* Only the depth pyramid samples it, create_logical_device
+	 * already left GPU culling off if D32 can't be sampled */
+	VkFormatProperties fmt_props;
+	vkGetPhysicalDeviceFormatProperties(this->physical_device, VK_FORMAT_D32_SFLOAT, &fmt_props);
+	if (!(fmt_props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT))
+	{
+		throw std::runtime_error("D32 depth can't be rendered to!");
+	}
+
+	VkImageCreateInfo image_info{};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.format = VK_FORMAT_D32_SFLOAT;
+	image_info.extent.width = this->sc_extent.width;
+	image_info.extent.height = this->sc_extent.height;
+	image_info.extent.depth = 1;
+	image_info.mipLevels = 1;
+	image_info.arrayLayers = 1;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	if (this->gpu_culling) image_info.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(this->device, &image_info, this->allocator, &this->depth_image) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth image!");
+	}
+
+	VkMemoryRequirements mem_reqs;
+	vkGetImageMemoryRequirements(this->device, this->depth_image, &mem_reqs);
+
+	VkMemoryAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = mem_reqs.size;
+	alloc_info.memoryTypeIndex = find_memory_type(mem_reqs.memoryTypeBits,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(this->device, &alloc_info, this->allocator, &this->depth_memory) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate depth memory!");
+	}
+	vkBindImageMemory(this->device, this->depth_image, this->depth_memory, 0);
+
+	create_image_view(this->depth_image, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, this->depth_view);
+}
+
+/* Deepest pyramid we ever build, 2^15 is past any swap chain */
+const uint32_t MAX_PYRAMID_LEVELS = 16;
+
+static VkDescriptorSetLayout create_set_layout(VkDevice device, const VkAllocationCallbacks* allocator,
+		const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	VkDescriptorSetLayoutCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	create_info.bindingCount = static_cast<uint32_t>(bindings.size());
+	create_info.pBindings = bindings.data();
+
+	VkDescriptorSetLayout layout;
+	if (vkCreateDescriptorSetLayout(device, &create_info, allocator, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor set layout!");
+	}
+	return layout;
+}
+
+static VkDescriptorSetLayoutBinding set_binding(uint32_t binding, VkDescriptorType type, VkShaderStageFlags stages)
+{
+	VkDescriptorSetLayoutBinding b{};
+	b.binding = binding;
+	b.descriptorType = type;
+	b.descriptorCount = 1;
+	b.stageFlags = stages;
+	return b;
+}
+
+/* Layouts for every pass plus one pool for all their sets, which
+ * are allocated up front and never freed */
+void Vk_Wrapper::create_descriptor_layouts()
+{
+	this->mesh_set_layout = create_set_layout(this->device, this->allocator, {
+		set_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
+	});
+	if (this->gpu_culling)
+	{
+		this->cull_set_layout = create_set_layout(this->device, this->allocator, {
+			set_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+			set_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+			set_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+			set_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+			set_binding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT),
+		});
+		this->reduce_set_layout = create_set_layout(this->device, this->allocator, {
+			set_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT),
+			set_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT),
+		});
+	}
+
+	VkDescriptorPoolSize pool_sizes[] = {
+		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, MAX_FRAMES_IN_FLIGHT},
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 * MAX_FRAMES_IN_FLIGHT + 1},
+		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_FRAMES_IN_FLIGHT + MAX_PYRAMID_LEVELS},
+		{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_PYRAMID_LEVELS},
+	};
+	VkDescriptorPoolCreateInfo pool_info{};
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.maxSets = 1 + MAX_FRAMES_IN_FLIGHT + MAX_PYRAMID_LEVELS;
+	pool_info.poolSizeCount = sizeof(pool_sizes) / sizeof(pool_sizes[0]);
+	pool_info.pPoolSizes = pool_sizes;
+
+	if (vkCreateDescriptorPool(this->device, &pool_info, this->allocator, &this->descriptor_pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor pool!");
+	}
+
+	VkDescriptorSetAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorPool = this->descriptor_pool;
+	alloc_info.descriptorSetCount = 1;
+	alloc_info.pSetLayouts = &this->mesh_set_layout;
+	if (vkAllocateDescriptorSets(this->device, &alloc_info, &this->mesh_set) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate descriptor sets!");
+	}
+
+	if (!this->gpu_culling) return;
+	alloc_info.pSetLayouts = &this->cull_set_layout;
+	for (auto& frame : this->cull_frames)
+	{
+		if (vkAllocateDescriptorSets(this->device, &alloc_info, &frame.set) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate descriptor sets!");
+		}
+	}
+}
+
+/* Same fixed function setup as the triangle, plus real vertex
+ * input and depth testing */
+void Vk_Wrapper::create_mesh_pipeline()
+{
+	VkShaderModule vert_sm;
+	VkShaderModule frag_sm;
+	try {
+		vert_sm = this->create_shader_module(read_file("shaders/mesh_vert.spv"));
+		frag_sm = this->create_shader_module(read_file("shaders/mesh_frag.spv"));
+	} catch (std::exception& e) {
+		throw std::runtime_error("Failed to create shaders: " + std::string(e.what()));
+	}
+
+	VkPipelineShaderStageCreateInfo shader_stages[2]{};
+	shader_stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shader_stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shader_stages[0].module = vert_sm;
+	shader_stages[0].pName = "main";
+	shader_stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shader_stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shader_stages[1].module = frag_sm;
+	shader_stages[1].pName = "main";
+
+	/* Packed_Vertex, see mesh_format.h */
+	VkVertexInputBindingDescription binding{};
+	binding.binding = 0;
+	binding.stride = sizeof(Packed_Vertex);
+	binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	VkVertexInputAttributeDescription attributes[3]{};
+	attributes[0].location = 0;
+	attributes[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+	attributes[0].offset = offsetof(Packed_Vertex, position);
+	attributes[1].location = 1;
+	attributes[1].format = VK_FORMAT_R8G8_SNORM;
+	attributes[1].offset = offsetof(Packed_Vertex, normal);
+	attributes[2].location = 2;
+	attributes[2].format = VK_FORMAT_R16G16_SFLOAT;
+	attributes[2].offset = offsetof(Packed_Vertex, uv);
+
+	VkPipelineVertexInputStateCreateInfo vertex_info{};
+	vertex_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertex_info.vertexBindingDescriptionCount = 1;
+	vertex_info.pVertexBindingDescriptions = &binding;
+	vertex_info.vertexAttributeDescriptionCount = 3;
+	vertex_info.pVertexAttributeDescriptions = attributes;
+
+	VkPipelineInputAssemblyStateCreateInfo input_asm{};
+	input_asm.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	input_asm.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	/* Viewport and scissor are dynamic */
+	VkPipelineViewportStateCreateInfo viewport_state{};
+	viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewport_state.viewportCount = 1;
+	viewport_state.scissorCount = 1;
+
+	/* meshconv keeps .obj winding, counter clockwise, and the
+	 * camera's projection flips y which preserves it */
+	VkPipelineRasterizationStateCreateInfo rasterizer{};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisampling{};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampling.minSampleShading = 1.0f;
+
+	VkPipelineDepthStencilStateCreateInfo depth_stencil{};
+	depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depth_stencil.depthTestEnable = VK_TRUE;
+	depth_stencil.depthWriteEnable = VK_TRUE;
+	depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+	VkPipelineColorBlendAttachmentState color_blend_att{};
+	color_blend_att.colorWriteMask =
+		  VK_COLOR_COMPONENT_R_BIT
+		| VK_COLOR_COMPONENT_G_BIT
+		| VK_COLOR_COMPONENT_B_BIT
+		| VK_COLOR_COMPONENT_A_BIT;
+
+	VkPipelineColorBlendStateCreateInfo color_blending{};
+	color_blending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	color_blending.attachmentCount = 1;
+	color_blending.pAttachments = &color_blend_att;
+
+	VkDynamicState dynamic_states[] = {
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR,
+	};
+	VkPipelineDynamicStateCreateInfo dynamic_state{};
+	dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamic_state.dynamicStateCount = sizeof(dynamic_states) / sizeof(dynamic_states[0]);
+	dynamic_state.pDynamicStates = dynamic_states;
+
+	/* Camera and dequantization in push constants,
+	 * instances in a storage buffer */
+	VkPushConstantRange mesh_range{};
+	mesh_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	mesh_range.offset = 0;
+	mesh_range.size = sizeof(Mesh_Params);
+
+	VkPipelineLayoutCreateInfo layout_info{};
+	layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layout_info.setLayoutCount = 1;
+	layout_info.pSetLayouts = &this->mesh_set_layout;
+	layout_info.pushConstantRangeCount = 1;
+	layout_info.pPushConstantRanges = &mesh_range;
+
+	if (vkCreatePipelineLayout(this->device, &layout_info, this->allocator, &this->mesh_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+
+	VkGraphicsPipelineCreateInfo pipeline_info{};
+	pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipeline_info.stageCount = 2;
+	pipeline_info.pStages = shader_stages;
+	pipeline_info.pVertexInputState = &vertex_info;
+	pipeline_info.pInputAssemblyState = &input_asm;
+	pipeline_info.pViewportState = &viewport_state;
+	pipeline_info.pRasterizationState = &rasterizer;
+	pipeline_info.pMultisampleState = &multisampling;
+	pipeline_info.pDepthStencilState = &depth_stencil;
+	pipeline_info.pColorBlendState = &color_blending;
+	pipeline_info.pDynamicState = &dynamic_state;
+	pipeline_info.layout = this->mesh_layout;
+	pipeline_info.renderPass = this->render_pass;
+	pipeline_info.subpass = 0;
+
+	if (vkCreateGraphicsPipelines(this->device, VK_NULL_HANDLE, 1, &pipeline_info, this->allocator,
+				&this->mesh_pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create mesh pipeline!");
+	}
+
+	vkDestroyShaderModule(this->device, frag_sm, this->allocator);
+	vkDestroyShaderModule(this->device, vert_sm, this->allocator);
+}
+
+VkPipeline Vk_Wrapper::create_compute_pipeline(const char* path, VkPipelineLayout layout)
+{
+	VkShaderModule module;
+	try {
+		module = this->create_shader_module(read_file(path));
+	} catch (std::exception& e) {
+		throw std::runtime_error("Failed to create shaders: " + std::string(e.what()));
+	}
+
+	VkComputePipelineCreateInfo pipeline_info{};
+	pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline_info.stage.module = module;
+	pipeline_info.stage.pName = "main";
+	pipeline_info.layout = layout;
+
+	VkPipeline pipeline;
+	if (vkCreateComputePipelines(this->device, VK_NULL_HANDLE, 1, &pipeline_info, this->allocator,
+				&pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error(std::string("failed to create compute pipeline ") + path);
+	}
+	vkDestroyShaderModule(this->device, module, this->allocator);
+	return pipeline;
+}
+
+/* Compute counterparts of the graphics pipeline, the culling pass
+ * and the depth pyramid reduction that feeds it */
+void Vk_Wrapper::create_cull_pipelines()
+{
+	if (!this->gpu_culling) return;
+
+	VkPipelineLayoutCreateInfo layout_info{};
+	layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layout_info.setLayoutCount = 1;
+	layout_info.pSetLayouts = &this->cull_set_layout;
+
+	if (vkCreatePipelineLayout(this->device, &layout_info, this->allocator, &this->cull_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+	this->cull_pipeline = create_compute_pipeline("shaders/cull.spv", this->cull_layout);
+
+	/* src size, dst size and src mip, see depth_reduce.glsl */
+	VkPushConstantRange reduce_range{};
+	reduce_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	reduce_range.offset = 0;
+	reduce_range.size = 5 * sizeof(int32_t);
+
+	layout_info.pSetLayouts = &this->reduce_set_layout;
+	layout_info.pushConstantRangeCount = 1;
+	layout_info.pPushConstantRanges = &reduce_range;
+
+	if (vkCreatePipelineLayout(this->device, &layout_info, this->allocator, &this->reduce_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+	this->reduce_pipeline = create_compute_pipeline("shaders/depth_reduce.spv", this->reduce_layout);
+}
+
+static uint32_t previous_pow2(uint32_t v)
+{
+	uint32_t p = 1;
+	while (p * 2 <= v) p *= 2;
+	return p;
+}
+
+/* Max depth mip chain for occlusion culling. Power of two sized so
+ * every level halves cleanly, level 0 is the largest power of two
+ * at or under the swap chain extent */
+void Vk_Wrapper::create_depth_pyramid()
+{
+	if (!this->gpu_culling) return;
+
+	this->pyramid_extent.width = previous_pow2(this->sc_extent.width);
+	this->pyramid_extent.height = previous_pow2(this->sc_extent.height);
+	this->pyramid_levels = 1;
+	while ((std::max(this->pyramid_extent.width, this->pyramid_extent.height) >> this->pyramid_levels) > 0)
+	{
+		this->pyramid_levels++;
+	}
+	this->pyramid_levels = std::min(this->pyramid_levels, MAX_PYRAMID_LEVELS);
+
+	VkImageCreateInfo image_info{};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.format = VK_FORMAT_R32_SFLOAT;
+	image_info.extent.width = this->pyramid_extent.width;
+	image_info.extent.height = this->pyramid_extent.height;
+	image_info.extent.depth = 1;
+	image_info.mipLevels = this->pyramid_levels;
+	image_info.arrayLayers = 1;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(this->device, &image_info, this->allocator, &this->pyramid_image) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid!");
+	}
+
+	VkMemoryRequirements mem_reqs;
+	vkGetImageMemoryRequirements(this->device, this->pyramid_image, &mem_reqs);
+
+	VkMemoryAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = mem_reqs.size;
+	alloc_info.memoryTypeIndex = find_memory_type(mem_reqs.memoryTypeBits,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(this->device, &alloc_info, this->allocator, &this->pyramid_memory) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate depth pyramid memory!");
+	}
+	vkBindImageMemory(this->device, this->pyramid_image, this->pyramid_memory, 0);
+
+	/* One view over every level for sampling, one per level to write */
+	create_image_view(this->pyramid_image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT,
+			0, this->pyramid_levels, this->pyramid_view);
+	this->pyramid_mip_views.resize(this->pyramid_levels);
+	for (uint32_t i = 0; i < this->pyramid_levels; ++i)
+	{
+		create_image_view(this->pyramid_image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT,
+				i, 1, this->pyramid_mip_views[i]);
+	}
+
+	/* Only ever read with texelFetch, but a sampler is still needed */
+	VkSamplerCreateInfo sampler_info{};
+	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_info.magFilter = VK_FILTER_NEAREST;
+	sampler_info.minFilter = VK_FILTER_NEAREST;
+	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+
+	if (vkCreateSampler(this->device, &sampler_info, this->allocator, &this->pyramid_sampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid sampler!");
+	}
+
+	/* Level 0 reduces the depth buffer, every other level the one above */
+	this->reduce_sets.resize(this->pyramid_levels);
+	std::vector<VkDescriptorSetLayout> layouts(this->pyramid_levels, this->reduce_set_layout);
+	VkDescriptorSetAllocateInfo set_info{};
+	set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	set_info.descriptorPool = this->descriptor_pool;
+	set_info.descriptorSetCount = this->pyramid_levels;
+	set_info.pSetLayouts = layouts.data();
+	if (vkAllocateDescriptorSets(this->device, &set_info, this->reduce_sets.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate descriptor sets!");
+	}
+
+	for (uint32_t i = 0; i < this->pyramid_levels; ++i)
+	{
+		VkDescriptorImageInfo src{};
+		src.sampler = this->pyramid_sampler;
+		src.imageView = i == 0 ? this->depth_view : this->pyramid_view;
+		src.imageLayout = i == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+		VkDescriptorImageInfo dst{};
+		dst.imageView = this->pyramid_mip_views[i];
+		dst.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		VkWriteDescriptorSet writes[2]{};
+		writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[0].dstSet = this->reduce_sets[i];
+		writes[0].dstBinding = 0;
+		writes[0].descriptorCount = 1;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[0].pImageInfo = &src;
+		writes[1] = writes[0];
+		writes[1].dstBinding = 1;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		writes[1].pImageInfo = &dst;
+		vkUpdateDescriptorSets(this->device, 2, writes, 0, nullptr);
+	}
+
+	/* The cull pass samples the whole pyramid */
+	VkDescriptorImageInfo pyramid{};
+	pyramid.sampler = this->pyramid_sampler;
+	pyramid.imageView = this->pyramid_view;
+	pyramid.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	for (auto& frame : this->cull_frames)
+	{
+		VkWriteDescriptorSet write{};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = frame.set;
+		write.dstBinding = 4;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.pImageInfo = &pyramid;
+		vkUpdateDescriptorSets(this->device, 1, &write, 0, nullptr);
+	}
+}
+
+void Vk_Wrapper::load_scene(const Mesh_File& file, const std::vector<Mesh_Instance>& instances)
+{
+	if (this->instance_count)
+	{
+		throw std::runtime_error("Scene already loaded");
+	}
+	if (instances.empty()) return;
+
+	this->scene_mesh = this->upload_mesh(file);
+	this->instance_count = static_cast<uint32_t>(instances.size());
+
+	/* Instances go up through a staging buffer like the mesh */
+	VkDeviceSize instance_bytes = instances.size() * sizeof(Mesh_Instance);
+	VkBuffer staging;
+	VkDeviceMemory staging_memory;
+	create_buffer(instance_bytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			staging, staging_memory);
+	void* mapped;
+	vkMapMemory(this->device, staging_memory, 0, instance_bytes, 0, &mapped);
+	memcpy(mapped, instances.data(), instance_bytes);
+	vkUnmapMemory(this->device, staging_memory);
+
+	create_buffer(instance_bytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, this->instance_buffer, this->instance_memory);
+
+	VkCommandBufferAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	alloc_info.commandPool = this->command_pool;
+	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	alloc_info.commandBufferCount = 1;
+
+	VkCommandBuffer cmd;
+	if (vkAllocateCommandBuffers(this->device, &alloc_info, &cmd) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate upload command buffer!");
+	}
+
+	VkCommandBufferBeginInfo begin_info{};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	this->dispatch.BeginCommandBuffer(cmd, &begin_info);
+
+	VkBufferCopy region{};
+	region.size = instance_bytes;
+	this->dispatch.CmdCopyBuffer(cmd, staging, this->instance_buffer, 1, &region);
+
+	/* The pyramid lives in GENERAL from here on, it is written and
+	 * sampled a level at a time */
+	if (this->gpu_culling)
+	{
+		VkImageMemoryBarrier to_general{};
+		to_general.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		to_general.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		to_general.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		to_general.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		to_general.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		to_general.image = this->pyramid_image;
+		to_general.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, this->pyramid_levels, 0, 1};
+		to_general.srcAccessMask = 0;
+		to_general.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		this->dispatch.CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0, 0, nullptr, 0, nullptr, 1, &to_general);
+	}
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	this->dispatch.CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	if (this->dispatch.EndCommandBuffer(cmd) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record upload command buffer!");
+	}
+
+	uint64_t value = this->submitter.enqueue(this->graphics_submit_id, cmd);
+	this->submitter.flush();
+	this->submitter.wait(this->graphics_submit_id, value);
+
+	vkFreeCommandBuffers(this->device, this->command_pool, 1, &cmd);
+	vkDestroyBuffer(this->device, staging, this->allocator);
+	vkFreeMemory(this->device, staging_memory, this->allocator);
+
+	VkDescriptorBufferInfo instance_info{this->instance_buffer, 0, VK_WHOLE_SIZE};
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = this->mesh_set;
+	write.dstBinding = 0;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = &instance_info;
+	vkUpdateDescriptorSets(this->device, 1, &write, 0, nullptr);
+
+	/* One indirect call draws every survivor, which the device
+	 * has to allow for when they all survive */
+	this->cull_scene = this->gpu_culling && this->instance_count <= this->max_draw_indirect_count;
+	if (this->gpu_culling && !this->cull_scene)
+	{
+		std::cerr << "Scene exceeds maxDrawIndirectCount, GPU culling disabled" << std::endl;
+	}
+	if (!this->cull_scene) return;
+
+	/* Per frame in flight, so a frame's cull never overwrites draws
+	 * the previous frame may still be reading. Room for every
+	 * instance being visible */
+	for (auto& frame : this->cull_frames)
+	{
+		create_buffer(this->instance_count * sizeof(VkDrawIndexedIndirectCommand),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.draws, frame.draws_memory);
+		create_buffer(sizeof(uint32_t),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+				| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.count, frame.count_memory);
+		create_buffer(sizeof(Cull_Params), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				frame.params, frame.params_memory);
+		vkMapMemory(this->device, frame.params_memory, 0, sizeof(Cull_Params), 0,
+				reinterpret_cast<void**>(&frame.params_mapped));
+
+		VkDescriptorBufferInfo buffers[4] = {
+			{frame.params, 0, VK_WHOLE_SIZE},
+			{this->instance_buffer, 0, VK_WHOLE_SIZE},
+			{frame.draws, 0, VK_WHOLE_SIZE},
+			{frame.count, 0, VK_WHOLE_SIZE},
+		};
+		VkWriteDescriptorSet writes[4]{};
+		for (uint32_t i = 0; i < 4; ++i)
+		{
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].dstSet = frame.set;
+			writes[i].dstBinding = i;
+			writes[i].descriptorCount = 1;
+			writes[i].descriptorType = i == 0
+				? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+				: VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[i].pBufferInfo = &buffers[i];
+		}
+		vkUpdateDescriptorSets(this->device, 4, writes, 0, nullptr);
+	}
+}
+
+/* Before the render pass. The CPU side is a fixed handful of commands
+ * and one small uniform write however many instances there are */
+void Vk_Wrapper::record_cull(VkCommandBuffer cmd)
+{
+	if (!this->cull_scene || !this->instance_count) return;
+
+	Cull_Frame& frame = this->cull_frames[this->current_frame];
+	const Mesh_Header& mesh = this->scene_mesh.header;
+
+	/* This slot's last frame is done, so the mapping is ours */
+	Cull_Params* params = frame.params_mapped;
+	float aspect = (float) this->sc_extent.width / (float) this->sc_extent.height;
+	this->camera.view_proj(aspect, params->view_proj);
+	memcpy(params->occlusion_view_proj, this->pyramid_view_proj, sizeof(params->occlusion_view_proj));
+	Frustum frustum = Frustum::from_view_proj(params->view_proj);
+	memcpy(params->planes, frustum.planes, sizeof(params->planes));
+	params->mesh_sphere[0] = mesh.center[0];
+	params->mesh_sphere[1] = mesh.center[1];
+	params->mesh_sphere[2] = mesh.center[2];
+	params->mesh_sphere[3] = mesh.radius;
+	params->instance_count = this->instance_count;
+	params->index_count = mesh.index_count;
+	params->occlusion = this->pyramid_valid;
+	params->pyramid_levels = this->pyramid_levels;
+	params->pyramid_size[0] = (float) this->pyramid_extent.width;
+	params->pyramid_size[1] = (float) this->pyramid_extent.height;
+
+	this->dispatch.CmdFillBuffer(cmd, frame.count, 0, sizeof(uint32_t), 0);
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	this->dispatch.CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	this->dispatch.CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->cull_pipeline);
+	this->dispatch.CmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->cull_layout,
+			0, 1, &frame.set, 0, nullptr);
+	this->dispatch.CmdDispatch(cmd, (this->instance_count + 63) / 64, 1, 1);
+
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	this->dispatch.CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+/* Inside the render pass, one draw call for the whole scene */
+void Vk_Wrapper::record_mesh_draw(VkCommandBuffer cmd)
+{
+	if (!this->instance_count) return;
+
+	const Mesh_Header& mesh = this->scene_mesh.header;
+	Mesh_Params params{};
+	float aspect = (float) this->sc_extent.width / (float) this->sc_extent.height;
+	this->camera.view_proj(aspect, params.view_proj);
+	for (int k = 0; k < 3; ++k)
+	{
+		params.pos_offset[k] = mesh.pos_offset[k];
+		params.pos_scale[k] = mesh.pos_scale[k];
+	}
+
+	this->dispatch.CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->mesh_pipeline);
+	this->dispatch.CmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->mesh_layout,
+			0, 1, &this->mesh_set, 0, nullptr);
+	this->dispatch.CmdPushConstants(cmd, this->mesh_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Mesh_Params), &params);
+
+	VkDeviceSize offset = 0;
+	this->dispatch.CmdBindVertexBuffers(cmd, 0, 1, &this->scene_mesh.vertex_buffer, &offset);
+	this->dispatch.CmdBindIndexBuffer(cmd, this->scene_mesh.index_buffer, 0, this->scene_mesh.index_type);
+
+	if (this->cull_scene)
+	{
+		const Cull_Frame& frame = this->cull_frames[this->current_frame];
+		this->dispatch.CmdDrawIndexedIndirectCount(cmd, frame.draws, 0, frame.count, 0, this->instance_count,
+				sizeof(VkDrawIndexedIndirectCommand));
+	} else
+	{
+		this->dispatch.CmdDrawIndexed(cmd, mesh.index_count, this->instance_count, 0, 0, 0);
+	}
+}
+
+/* After the render pass, reduce this frame's depth into the pyramid
+ * that next frame's cull pass tests against */
+void Vk_Wrapper::record_depth_pyramid(VkCommandBuffer cmd, VkExtent2D render_extent)
+{
+	if (!this->cull_scene || !this->instance_count) return;
+
+	/* This frame's cull pass reads the pyramid we are about to overwrite */
+	this->dispatch.CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	this->dispatch.CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->reduce_pipeline);
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	int32_t src_width = (int32_t) render_extent.width;
+	int32_t src_height = (int32_t) render_extent.height;
+	for (uint32_t i = 0; i < this->pyramid_levels; ++i)
+	{
+		int32_t dst_width = std::max(1u, this->pyramid_extent.width >> i);
+		int32_t dst_height = std::max(1u, this->pyramid_extent.height >> i);
+		int32_t reduce_params[5] = {src_width, src_height, dst_width, dst_height, i == 0 ? 0 : (int32_t) i - 1};
+
+		this->dispatch.CmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->reduce_layout,
+				0, 1, &this->reduce_sets[i], 0, nullptr);
+		this->dispatch.CmdPushConstants(cmd, this->reduce_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+				0, sizeof(reduce_params), reduce_params);
+		this->dispatch.CmdDispatch(cmd, (dst_width + 7) / 8, (dst_height + 7) / 8, 1);
+
+		/* Covers the next level's read, and next frame's cull pass */
+		this->dispatch.CmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		src_width = dst_width;
+		src_height = dst_height;
+	}
+
+	float aspect = (float) this->sc_extent.width / (float) this->sc_extent.height;
+	this->camera.view_proj(aspect, this->pyramid_view_proj);
+	this->pyramid_valid = true;
 }
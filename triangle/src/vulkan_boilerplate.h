@@ -3,6 +3,17 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "camera.h"
+#include "dynamic_resolution.h"
+#include "frame_capture.h"
+#include "deletion_queue.h"
+#include "device_dispatch.h"
+#include "host_allocator.h"
+#include "mesh_file.h"
+#include "scene_params.h"
+#include "submit_batcher.h"
+
+#include <chrono>
 #include <set>
 #include <iostream>
 #include <stdexcept>
@@ -14,6 +25,7 @@
 
 const uint32_t WIDTH = 1280;
 const uint32_t HEIGHT = 720;
+const int MAX_FRAMES_IN_FLIGHT = 2;
 
 #ifdef DEBUG
 	const bool enable_validation_layers = true;
@@ -31,6 +43,59 @@ struct queue_family_indices_t
 
 struct swap_chain_support_details_t;
 
+/* One copy of the scene mesh, uniform scale then translate.
+ * Read by cull.glsl and mesh_vert.glsl, keep all three in sync */
+struct Mesh_Instance
+{
+	float position[3];
+	float scale;
+};
+
+/* Push constant block read by mesh_vert.glsl */
+struct Mesh_Params
+{
+	float view_proj[16];
+	float pos_offset[4];
+	float pos_scale[4];
+};
+
+/* Uniform block read by cull.glsl, std140 */
+struct Cull_Params
+{
+	float view_proj[16];
+	/* Matrix the depth pyramid was rendered with, last frame's */
+	float occlusion_view_proj[16];
+	float planes[6][4];
+	float mesh_sphere[4];
+	uint32_t instance_count;
+	uint32_t index_count;
+	uint32_t occlusion;
+	uint32_t pyramid_levels;
+	float pyramid_size[2];
+	float pad[2];
+};
+
+/* Device local copy of a Mesh_File. The header is kept for the
+ * dequantization constants and bounds */
+struct Gpu_Mesh
+{
+	Mesh_Header header{};
+	VkBuffer vertex_buffer = VK_NULL_HANDLE;
+	VkBuffer index_buffer = VK_NULL_HANDLE;
+	VkBuffer meshlet_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory vertex_memory = VK_NULL_HANDLE;
+	VkDeviceMemory index_memory = VK_NULL_HANDLE;
+	VkDeviceMemory meshlet_memory = VK_NULL_HANDLE;
+	VkIndexType index_type = VK_INDEX_TYPE_UINT16;
+};
+
+/* Wall time of one step of Vk_Wrapper::init */
+struct Init_Stage
+{
+	const char* name;
+	double ms;
+};
+
 /* Wrap all vulkan setup inside an object
  * and selectively expose the attributes that
  * a future game my actually need to use */
@@ -39,20 +104,144 @@ struct Vk_Wrapper
 	VkInstance instance;
 	VkSurfaceKHR surface;
 	GLFWwindow* window;
+	/* Every driver host allocation goes through here */
+	Host_Allocator host_alloc;
+	/* Set before init. The window is never shown, and on GLFW 3.4+
+	 * there is no window system at all, for benchmarks and CI */
+	bool headless = false;
+	/* Set before init. Extra copies of the triangle pipeline that
+	 * differ in state with no visible effect, each bound and drawn
+	 * every frame. For measuring pipeline binds */
+	uint32_t extra_pipelines = 0;
+	/* Filled in by init, in the order the stages ran */
+	std::vector<Init_Stage> init_stages;
+	/* Driver host allocations made during the last draw_frame,
+	 * should settle at zero once everything is warmed up */
+	uint64_t frame_host_allocs = 0;
+	Dynamic_Resolution dyn_res;
+	Frame_Capture capture;
+	/* Set by the app before each draw_frame */
+	Scene_Params scene{};
+	Camera camera;
+	/* Retire objects here with submitted_frames() rather than
+	 * destroying them while a frame in flight may still use them */
+	Deletion_Queue deletion_queue;
+	/* All queue submission goes through here */
+	Submit_Batcher submitter;
+	uint32_t graphics_submit_id;
 
 	void init();
+	void draw_frame();
 	void cleanup();
+	/* Copies a mapped mesh into device local buffers, blocking until
+	 * the transfer is done. Hand the result back to destroy_mesh */
+	Gpu_Mesh upload_mesh(const Mesh_File& file);
+	void destroy_mesh(Gpu_Mesh& mesh);
+	/* Draws instances of one mesh every frame from here on, culled on
+	 * the GPU when the device can. Call once, before the first frame */
+	void load_scene(const Mesh_File& file, const std::vector<Mesh_Instance>& instances);
+	/* False if the device lacks indirect count, multi draw indirect,
+	 * first instance or sampled depth support, or the scene has more
+	 * instances than one indirect call may draw. The scene is then
+	 * drawn unculled */
+	bool gpu_culling_enabled() const { return this->cull_scene; }
+	/* Index of the last submitted frame, counting from 1 */
+	uint64_t submitted_frames() const { return this->frame_count; }
+	/* Every frame up to and including this one has finished on the GPU */
+	uint64_t completed_frames() const { return this->completed_frame; }
 private:
+	const VkAllocationCallbacks* allocator = host_alloc.callbacks();
 	VkQueue graphics_queue;
 	VkQueue present_queue;
 	VkDevice device;
 	VkPhysicalDevice physical_device;
 	VkDebugUtilsMessengerEXT debugMessenger;
+	Instance_Dispatch instance_dispatch;
+	/* Loaded once the device exists, used for everything per frame */
+	Device_Dispatch dispatch;
 	queue_family_indices_t indices;
-	VkSwapchainKHR swap_chain;
+	VkSwapchainKHR swap_chain = VK_NULL_HANDLE;
+	/* Set when acquire or present says so, draw_frame recreates it */
+	bool sc_out_of_date = false;
 	VkFormat sc_image_fmt;
 	VkExtent2D sc_extent;
 	VkPipelineLayout pipe_layout;
+	VkRenderPass render_pass;
+	VkPipeline graphics_pipeline;
+	std::vector<VkPipeline> variant_pipelines;
+	VkCommandPool command_pool;
+	std::vector<VkCommandBuffer> command_buffers;
+	std::vector<VkSemaphore> image_available_sems;
+	std::vector<VkSemaphore> render_finished_sems;
+	/* Graphics timeline value each frame in flight slot signals */
+	uint64_t slot_timeline[MAX_FRAMES_IN_FLIGHT] = {};
+	size_t current_frame = 0;
+	uint64_t frame_count = 0;
+	uint64_t completed_frame = 0;
+	/* Frame index last submitted from each frame in flight slot */
+	uint64_t slot_frame[MAX_FRAMES_IN_FLIGHT] = {};
+	/* Internal render target, always allocated at the full
+	 * swap chain extent. Dynamic resolution renders into a
+	 * sub rectangle of it and blits that to the swap chain */
+	VkImage rt_image;
+	VkDeviceMemory rt_memory;
+	VkImageView rt_view;
+	VkFramebuffer rt_framebuffer;
+	/* Two timestamps per frame in flight, bracketing the frame */
+	VkQueryPool timestamp_pool = VK_NULL_HANDLE;
+	float timestamp_period = 0.0f;
+	bool timestamps_pending[MAX_FRAMES_IN_FLIGHT] = {};
+	/* Scene depth, sampled afterwards to build the depth pyramid */
+	VkImage depth_image;
+	VkDeviceMemory depth_memory;
+	VkImageView depth_view;
+	/* GPU culling. Each frame a compute pass tests every instance
+	 * against the frustum and last frame's depth pyramid and writes
+	 * the survivors' draws, which are drawn with one indirect call */
+	bool gpu_culling = false;
+	/* gpu_culling and the loaded scene fits maxDrawIndirectCount */
+	bool cull_scene = false;
+	uint32_t max_draw_indirect_count = 0;
+	Gpu_Mesh scene_mesh;
+	VkBuffer instance_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory instance_memory = VK_NULL_HANDLE;
+	uint32_t instance_count = 0;
+	VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+	VkDescriptorSetLayout mesh_set_layout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout cull_set_layout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout reduce_set_layout = VK_NULL_HANDLE;
+	VkDescriptorSet mesh_set = VK_NULL_HANDLE;
+	VkPipelineLayout mesh_layout = VK_NULL_HANDLE;
+	VkPipeline mesh_pipeline = VK_NULL_HANDLE;
+	VkPipelineLayout cull_layout = VK_NULL_HANDLE;
+	VkPipeline cull_pipeline = VK_NULL_HANDLE;
+	VkPipelineLayout reduce_layout = VK_NULL_HANDLE;
+	VkPipeline reduce_pipeline = VK_NULL_HANDLE;
+	struct Cull_Frame
+	{
+		VkBuffer draws = VK_NULL_HANDLE;
+		VkDeviceMemory draws_memory = VK_NULL_HANDLE;
+		VkBuffer count = VK_NULL_HANDLE;
+		VkDeviceMemory count_memory = VK_NULL_HANDLE;
+		VkBuffer params = VK_NULL_HANDLE;
+		VkDeviceMemory params_memory = VK_NULL_HANDLE;
+		Cull_Params* params_mapped = nullptr;
+		VkDescriptorSet set = VK_NULL_HANDLE;
+	};
+	Cull_Frame cull_frames[MAX_FRAMES_IN_FLIGHT];
+	/* Max depth pyramid, power of two sized and covering whatever
+	 * part of the depth buffer dynamic resolution rendered to */
+	VkImage pyramid_image = VK_NULL_HANDLE;
+	VkDeviceMemory pyramid_memory = VK_NULL_HANDLE;
+	VkImageView pyramid_view = VK_NULL_HANDLE;
+	std::vector<VkImageView> pyramid_mip_views;
+	std::vector<VkDescriptorSet> reduce_sets;
+	VkSampler pyramid_sampler = VK_NULL_HANDLE;
+	VkExtent2D pyramid_extent{};
+	uint32_t pyramid_levels = 0;
+	bool pyramid_valid = false;
+	float pyramid_view_proj[16] = {};
+	std::chrono::steady_clock::time_point init_mark;
 	std::vector<VkImageView> sc_image_views;
 	std::vector<VkImage> sc_images;
 	/* sc_images needs to be the last member
@@ -70,7 +259,28 @@ private:
 	void pick_physical_device();
 	void create_swap_chain();
 	void create_image_views();
+	void recreate_swap_chain();
+	void create_render_target();
+	void create_render_pass();
 	void create_graphics_pipeline();
+	void create_framebuffers();
+	void create_command_pool();
+	void create_command_buffers();
+	void create_sync_objects();
+	void create_query_pool();
+	void create_capture_buffers();
+	void create_depth_resources();
+	void create_descriptor_layouts();
+	void create_mesh_pipeline();
+	void create_cull_pipelines();
+	void create_depth_pyramid();
+	void end_init_stage(const char* name);
+	VkPipeline create_compute_pipeline(const char* path, VkPipelineLayout layout);
+	void record_cull(VkCommandBuffer cmd);
+	void record_mesh_draw(VkCommandBuffer cmd);
+	void record_depth_pyramid(VkCommandBuffer cmd, VkExtent2D render_extent);
+	void record_command_buffer(VkCommandBuffer cmd, uint32_t image_index);
+	float read_gpu_frame_time(size_t frame);
 
 	/* These functions are used to query potential devices,
 	 * however they need access to surface or device properties so
@@ -79,6 +289,11 @@ private:
 	 * Potential_TODO: These might be worth deobjectifying
 	 * */
 	VkShaderModule create_shader_module(const std::vector<char>& code);
+	uint32_t find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties);
+	void create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
+			VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& memory);
+	void create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspect,
+			uint32_t base_mip, uint32_t mip_count, VkImageView& view);
 	VkSurfaceFormatKHR pick_sc_surface_format(const std::vector<VkSurfaceFormatKHR>&);
 	VkPresentModeKHR pick_sc_present_format(const std::vector<VkPresentModeKHR>&);
 	swap_chain_support_details_t query_swap_chain_support(VkPhysicalDevice);
@@ -0,0 +1,718 @@
+/*
+ * meshconv.cc
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Offline converter from Wavefront .obj to the .tmsh format in
+ * src/mesh_format.h. Does all the work the runtime shouldn't:
+ *
+ *  - welds identical vertices
+ *  - reorders triangles for the post transform vertex cache
+ *    (Forsyth, "Linear-Speed Vertex Cache Optimisation")
+ *  - reorders cache sized clusters of triangles front to back to
+ *    cut overdraw (after Sander et al., "Fast Triangle Reordering
+ *    for Vertex Locality and Reduced Overdraw")
+ *  - reorders vertices into first use order for fetch locality
+ *  - splits the result into meshlets with culling bounds
+ *  - quantizes everything into Packed_Vertex
+ *
+ * usage: meshconv input.obj output.tmsh
+ */
+
+#include "../src/mesh_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+struct Vertex
+{
+	float pos[3];
+	float normal[3];
+	float uv[2];
+};
+
+struct Mesh
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+};
+
+/* Helpers */
+static void sub(const float* a, const float* b, float* out)
+{
+	out[0] = a[0] - b[0]; out[1] = a[1] - b[1]; out[2] = a[2] - b[2];
+}
+
+static void cross(const float* a, const float* b, float* out)
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float dot(const float* a, const float* b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void normalize(float* v)
+{
+	float len = std::sqrt(dot(v, v));
+	if (len > 0.0f)
+	{
+		v[0] /= len; v[1] /= len; v[2] /= len;
+	}
+}
+
+/* Unnormalized, so its length is twice the triangle area */
+static void face_normal(const Mesh& mesh, const uint32_t* tri, float* out)
+{
+	float e0[3], e1[3];
+	sub(mesh.vertices[tri[1]].pos, mesh.vertices[tri[0]].pos, e0);
+	sub(mesh.vertices[tri[2]].pos, mesh.vertices[tri[0]].pos, e1);
+	cross(e0, e1, out);
+}
+
+/* Average cache misses per triangle on a FIFO cache, what GPUs
+ * actually roughly have. 0.5 is the theoretical best, 3 the worst */
+static float acmr(const std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size)
+{
+	std::vector<uint32_t> stamp(vertex_count, 0);
+	uint32_t clock = cache_size + 1;
+	size_t misses = 0;
+	for (uint32_t index : indices)
+	{
+		if (clock - stamp[index] > cache_size)
+		{
+			stamp[index] = clock++;
+			misses++;
+		}
+	}
+	return indices.empty() ? 0.0f : (float) misses / (indices.size() / 3);
+}
+
+/* OBJ loading, positions/uvs/normals and polygon faces only */
+/* OBJ indices are 1 based, negative ones count back from the end */
+static int obj_index(int index, size_t count)
+{
+	int resolved = index < 0 ? (int) count + index : index - 1;
+	if (index == 0 || resolved < 0 || resolved >= (int) count)
+	{
+		throw std::runtime_error("OBJ index " + std::to_string(index) + " out of range");
+	}
+	return resolved;
+}
+
+static Mesh load_obj(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open " + path);
+	}
+
+	std::vector<float> positions, uvs, normals;
+	std::map<std::tuple<int, int, int>, uint32_t> welded;
+	Mesh mesh;
+	bool has_normals = true;
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream in(line);
+		std::string tag;
+		in >> tag;
+
+		if (tag == "v")
+		{
+			float x, y, z;
+			in >> x >> y >> z;
+			positions.insert(positions.end(), {x, y, z});
+		} else if (tag == "vt")
+		{
+			float u, v;
+			in >> u >> v;
+			uvs.insert(uvs.end(), {u, v});
+		} else if (tag == "vn")
+		{
+			float x, y, z;
+			in >> x >> y >> z;
+			normals.insert(normals.end(), {x, y, z});
+		} else if (tag == "f")
+		{
+			std::vector<uint32_t> face;
+			std::string corner;
+			while (in >> corner)
+			{
+				int v = 0, t = 0, n = 0;
+				if (sscanf(corner.c_str(), "%d/%d/%d", &v, &t, &n) != 3
+						&& sscanf(corner.c_str(), "%d//%d", &v, &n) != 2
+						&& sscanf(corner.c_str(), "%d/%d", &v, &t) != 2)
+				{
+					sscanf(corner.c_str(), "%d", &v);
+				}
+				int vi = obj_index(v, positions.size() / 3);
+				int ti = t ? obj_index(t, uvs.size() / 2) : -1;
+				int ni = n ? obj_index(n, normals.size() / 3) : -1;
+				if (ni < 0) has_normals = false;
+
+				auto key = std::make_tuple(vi, ti, ni);
+				auto found = welded.find(key);
+				if (found == welded.end())
+				{
+					Vertex vert{};
+					memcpy(vert.pos, &positions[vi * 3], sizeof(vert.pos));
+					if (ti >= 0) memcpy(vert.uv, &uvs[ti * 2], sizeof(vert.uv));
+					if (ni >= 0) memcpy(vert.normal, &normals[ni * 3], sizeof(vert.normal));
+					found = welded.emplace(key, (uint32_t) mesh.vertices.size()).first;
+					mesh.vertices.push_back(vert);
+				}
+				face.push_back(found->second);
+			}
+
+			/* Fan triangulate. Triangles that repeat a vertex draw
+			 * nothing, and the cache optimiser's adjacency bookkeeping
+			 * assumes three distinct vertices, so they're dropped */
+			for (size_t i = 2; i < face.size(); ++i)
+			{
+				uint32_t a = face[0], b = face[i - 1], c = face[i];
+				if (a == b || b == c || a == c) continue;
+				mesh.indices.insert(mesh.indices.end(), {a, b, c});
+			}
+		}
+	}
+
+	/* No normals in the file, use area weighted face normals */
+	if (!has_normals)
+	{
+		for (auto& v : mesh.vertices)
+		{
+			v.normal[0] = v.normal[1] = v.normal[2] = 0.0f;
+		}
+		for (size_t i = 0; i < mesh.indices.size(); i += 3)
+		{
+			float n[3];
+			face_normal(mesh, &mesh.indices[i], n);
+			for (int k = 0; k < 3; ++k)
+			{
+				float* vn = mesh.vertices[mesh.indices[i + k]].normal;
+				vn[0] += n[0]; vn[1] += n[1]; vn[2] += n[2];
+			}
+		}
+	}
+	for (auto& v : mesh.vertices)
+	{
+		normalize(v.normal);
+	}
+
+	return mesh;
+}
+
+/* Forsyth's vertex cache optimisation */
+const int FORSYTH_CACHE_SIZE = 32;
+
+static float forsyth_score(int cache_pos, uint32_t remaining)
+{
+	if (remaining == 0) return -1.0f;
+
+	float score = 0.0f;
+	if (cache_pos >= 0)
+	{
+		/* The last triangle's vertices get a fixed score so we
+		 * don't just keep fanning around the same vertex */
+		if (cache_pos < 3)
+		{
+			score = 0.75f;
+		} else
+		{
+			float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+			score = std::pow(1.0f - (cache_pos - 3) * scaler, 1.5f);
+		}
+	}
+	/* Favour vertices with few triangles left, so we finish them off */
+	score += 2.0f / std::sqrt((float) remaining);
+	return score;
+}
+
+static void optimize_vertex_cache(Mesh& mesh)
+{
+	size_t vertex_count = mesh.vertices.size();
+	size_t tri_count = mesh.indices.size() / 3;
+
+	/* Vertex -> triangle adjacency */
+	std::vector<uint32_t> remaining(vertex_count, 0);
+	for (uint32_t index : mesh.indices) remaining[index]++;
+	std::vector<uint32_t> adj_offset(vertex_count + 1, 0);
+	for (size_t v = 0; v < vertex_count; ++v) adj_offset[v + 1] = adj_offset[v] + remaining[v];
+	std::vector<uint32_t> adj(mesh.indices.size());
+	std::vector<uint32_t> fill(adj_offset.begin(), adj_offset.end() - 1);
+	for (size_t t = 0; t < tri_count; ++t)
+	{
+		for (int k = 0; k < 3; ++k) adj[fill[mesh.indices[t * 3 + k]]++] = (uint32_t) t;
+	}
+
+	std::vector<int> cache_pos(vertex_count, -1);
+	std::vector<float> vert_score(vertex_count);
+	for (size_t v = 0; v < vertex_count; ++v) vert_score[v] = forsyth_score(-1, remaining[v]);
+
+	std::vector<float> tri_score(tri_count);
+	std::vector<bool> emitted(tri_count, false);
+	for (size_t t = 0; t < tri_count; ++t)
+	{
+		const uint32_t* tri = &mesh.indices[t * 3];
+		tri_score[t] = vert_score[tri[0]] + vert_score[tri[1]] + vert_score[tri[2]];
+	}
+
+	std::vector<uint32_t> cache, next_cache;
+	std::vector<uint32_t> out;
+	out.reserve(mesh.indices.size());
+	size_t cursor = 0;
+	int64_t best = -1;
+
+	for (size_t emitted_count = 0; emitted_count < tri_count; ++emitted_count)
+	{
+		/* Nothing useful in the cache, take the next untouched triangle */
+		if (best < 0)
+		{
+			while (emitted[cursor]) cursor++;
+			best = (int64_t) cursor;
+		}
+
+		const uint32_t* tri = &mesh.indices[best * 3];
+		out.insert(out.end(), tri, tri + 3);
+		emitted[best] = true;
+
+		/* Drop the triangle from its vertices' adjacency */
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t v = tri[k];
+			uint32_t* list = &adj[adj_offset[v]];
+			for (uint32_t i = 0; i < remaining[v]; ++i)
+			{
+				if (list[i] == (uint32_t) best)
+				{
+					list[i] = list[remaining[v] - 1];
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+
+		/* New LRU cache, this triangle's vertices at the front */
+		next_cache.assign(tri, tri + 3);
+		for (uint32_t v : cache)
+		{
+			if (v != tri[0] && v != tri[1] && v != tri[2]) next_cache.push_back(v);
+		}
+		/* Vertices pushed out of the cache lose their cache score */
+		for (size_t i = FORSYTH_CACHE_SIZE; i < next_cache.size(); ++i)
+		{
+			cache_pos[next_cache[i]] = -1;
+			vert_score[next_cache[i]] = forsyth_score(-1, remaining[next_cache[i]]);
+		}
+		if (next_cache.size() > (size_t) FORSYTH_CACHE_SIZE) next_cache.resize(FORSYTH_CACHE_SIZE);
+		cache.swap(next_cache);
+
+		/* Rescore everything in the cache and pick the best
+		 * triangle touching it for next time */
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			cache_pos[cache[i]] = (int) i;
+			vert_score[cache[i]] = forsyth_score((int) i, remaining[cache[i]]);
+		}
+		best = -1;
+		float best_score = -1.0f;
+		for (uint32_t v : cache)
+		{
+			for (uint32_t i = 0; i < remaining[v]; ++i)
+			{
+				uint32_t t = adj[adj_offset[v] + i];
+				const uint32_t* other = &mesh.indices[t * 3];
+				tri_score[t] = vert_score[other[0]] + vert_score[other[1]] + vert_score[other[2]];
+				if (tri_score[t] > best_score)
+				{
+					best_score = tri_score[t];
+					best = t;
+				}
+			}
+		}
+	}
+
+	mesh.indices.swap(out);
+}
+
+/* Overdraw: cut the cache optimized order into clusters wherever the
+ * cache would restart anyway, then draw outward facing clusters first
+ * so they occlude the rest. Reordering whole clusters keeps almost
+ * all of the cache efficiency */
+const uint32_t OVERDRAW_CACHE_SIZE = 16;
+
+static void optimize_overdraw(Mesh& mesh)
+{
+	size_t tri_count = mesh.indices.size() / 3;
+	if (tri_count == 0) return;
+
+	/* Cluster boundaries, at triangles where every vertex misses */
+	std::vector<size_t> cluster_start;
+	std::vector<uint32_t> stamp(mesh.vertices.size(), 0);
+	uint32_t clock = OVERDRAW_CACHE_SIZE + 1;
+	for (size_t t = 0; t < tri_count; ++t)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t v = mesh.indices[t * 3 + k];
+			if (clock - stamp[v] > OVERDRAW_CACHE_SIZE)
+			{
+				stamp[v] = clock++;
+				misses++;
+			}
+		}
+		if (misses == 3 || t == 0) cluster_start.push_back(t);
+	}
+	cluster_start.push_back(tri_count);
+
+	/* Mesh centroid */
+	float mesh_center[3] = {0.0f, 0.0f, 0.0f};
+	for (const auto& v : mesh.vertices)
+	{
+		mesh_center[0] += v.pos[0]; mesh_center[1] += v.pos[1]; mesh_center[2] += v.pos[2];
+	}
+	for (int k = 0; k < 3; ++k) mesh_center[k] /= mesh.vertices.size();
+
+	struct Cluster { size_t begin, end; float sort_key; };
+	std::vector<Cluster> clusters;
+	for (size_t c = 0; c + 1 < cluster_start.size(); ++c)
+	{
+		float center[3] = {0.0f, 0.0f, 0.0f};
+		float normal[3] = {0.0f, 0.0f, 0.0f};
+		float area = 0.0f;
+		for (size_t t = cluster_start[c]; t < cluster_start[c + 1]; ++t)
+		{
+			const uint32_t* tri = &mesh.indices[t * 3];
+			float n[3];
+			face_normal(mesh, tri, n);
+			float a = std::sqrt(dot(n, n));
+			for (int k = 0; k < 3; ++k)
+			{
+				center[k] += a * (mesh.vertices[tri[0]].pos[k]
+						+ mesh.vertices[tri[1]].pos[k]
+						+ mesh.vertices[tri[2]].pos[k]) / 3.0f;
+				normal[k] += n[k];
+			}
+			area += a;
+		}
+		if (area > 0.0f)
+		{
+			for (int k = 0; k < 3; ++k) center[k] /= area;
+		}
+		normalize(normal);
+
+		float out[3];
+		sub(center, mesh_center, out);
+		clusters.push_back({cluster_start[c], cluster_start[c + 1], dot(out, normal)});
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+		return a.sort_key > b.sort_key;
+	});
+
+	std::vector<uint32_t> out;
+	out.reserve(mesh.indices.size());
+	for (const auto& c : clusters)
+	{
+		out.insert(out.end(), mesh.indices.begin() + c.begin * 3, mesh.indices.begin() + c.end * 3);
+	}
+	mesh.indices.swap(out);
+}
+
+/* Renumber vertices in the order the index buffer first uses them */
+static void optimize_vertex_fetch(Mesh& mesh)
+{
+	std::vector<uint32_t> remap(mesh.vertices.size(), UINT32_MAX);
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+
+	for (uint32_t& index : mesh.indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = (uint32_t) vertices.size();
+			vertices.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+	/* Unreferenced vertices get dropped here */
+	mesh.vertices.swap(vertices);
+}
+
+static void bounding_sphere(const Mesh& mesh, const std::vector<uint32_t>& verts, float* center, float& radius)
+{
+	float lo[3] = {INFINITY, INFINITY, INFINITY};
+	float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+	for (uint32_t v : verts)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			lo[k] = std::min(lo[k], mesh.vertices[v].pos[k]);
+			hi[k] = std::max(hi[k], mesh.vertices[v].pos[k]);
+		}
+	}
+	for (int k = 0; k < 3; ++k) center[k] = (lo[k] + hi[k]) * 0.5f;
+
+	radius = 0.0f;
+	for (uint32_t v : verts)
+	{
+		float d[3];
+		sub(mesh.vertices[v].pos, center, d);
+		radius = std::max(radius, std::sqrt(dot(d, d)));
+	}
+}
+
+static int8_t snorm8(float v)
+{
+	return (int8_t) std::lround(std::clamp(v, -1.0f, 1.0f) * 127.0f);
+}
+
+static std::vector<Meshlet> build_meshlets(const Mesh& mesh)
+{
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> marker(mesh.vertices.size(), UINT32_MAX);
+	std::vector<uint32_t> verts;
+	size_t tri_count = mesh.indices.size() / 3;
+	size_t first = 0;
+
+	auto finish = [&](size_t end) {
+		Meshlet m{};
+		m.first_index = (uint32_t) (first * 3);
+		m.index_count = (uint32_t) ((end - first) * 3);
+		m.vertex_count = (uint32_t) verts.size();
+		bounding_sphere(mesh, verts, m.center, m.radius);
+
+		/* Normal cone over the triangles */
+		float axis[3] = {0.0f, 0.0f, 0.0f};
+		std::vector<float> normals;
+		for (size_t t = first; t < end; ++t)
+		{
+			float n[3];
+			face_normal(mesh, &mesh.indices[t * 3], n);
+			normalize(n);
+			normals.insert(normals.end(), n, n + 3);
+			axis[0] += n[0]; axis[1] += n[1]; axis[2] += n[2];
+		}
+		normalize(axis);
+		float min_dot = 1.0f;
+		for (size_t i = 0; i < normals.size(); i += 3)
+		{
+			min_dot = std::min(min_dot, dot(&normals[i], axis));
+		}
+
+		for (int k = 0; k < 3; ++k) m.cone_axis[k] = snorm8(axis[k]);
+		if (min_dot <= 0.1f)
+		{
+			/* Wider than a hemisphere, can never be backface culled */
+			m.cone_cutoff = 127;
+		} else
+		{
+			/* sin of the cone half angle, rounded up so quantization
+			 * only ever makes the test more conservative */
+			float cutoff = std::sqrt(1.0f - min_dot * min_dot);
+			m.cone_cutoff = (int8_t) std::min(127.0f, std::ceil(cutoff * 127.0f) + 1.0f);
+		}
+		meshlets.push_back(m);
+
+		verts.clear();
+		first = end;
+	};
+
+	for (size_t t = 0; t < tri_count; ++t)
+	{
+		const uint32_t* tri = &mesh.indices[t * 3];
+		uint32_t id = (uint32_t) meshlets.size();
+		int new_verts = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			if (marker[tri[k]] != id) new_verts++;
+		}
+
+		if (verts.size() + new_verts > MESHLET_MAX_VERTICES || t - first >= MESHLET_MAX_TRIANGLES)
+		{
+			finish(t);
+			id = (uint32_t) meshlets.size();
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			if (marker[tri[k]] != id)
+			{
+				marker[tri[k]] = id;
+				verts.push_back(tri[k]);
+			}
+		}
+	}
+	if (first < tri_count) finish(tri_count);
+
+	return meshlets;
+}
+
+/* IEEE half, round to nearest, flushing denormals */
+static uint16_t to_half(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exp = (int32_t) ((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mant = bits & 0x7fffff;
+
+	if (exp <= 0) return (uint16_t) sign;
+	if (exp >= 31) return (uint16_t) (sign | 0x7c00);
+	uint32_t half = sign | (exp << 10) | (mant >> 13);
+	if (mant & 0x1000) half++; // Carries into the exponent correctly
+	return (uint16_t) half;
+}
+
+/* Octahedral normal encoding */
+static void oct_encode(const float* n, int8_t* out)
+{
+	float l1 = std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]);
+	float x = l1 > 0.0f ? n[0] / l1 : 0.0f;
+	float y = l1 > 0.0f ? n[1] / l1 : 0.0f;
+	if (n[2] < 0.0f)
+	{
+		float ox = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float oy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = ox;
+		y = oy;
+	}
+	out[0] = snorm8(x);
+	out[1] = snorm8(y);
+}
+
+static uint64_t align_section(uint64_t offset)
+{
+	return (offset + MESH_SECTION_ALIGN - 1) & ~(uint64_t) (MESH_SECTION_ALIGN - 1);
+}
+
+static void write_mesh(const Mesh& mesh, const std::vector<Meshlet>& meshlets, const std::string& path)
+{
+	Mesh_Header header{};
+	header.magic = MESH_MAGIC;
+	header.version = MESH_VERSION;
+	header.vertex_count = (uint32_t) mesh.vertices.size();
+	header.index_count = (uint32_t) mesh.indices.size();
+	header.index_size = mesh.vertices.size() <= 0xffff ? 2 : 4;
+	header.meshlet_count = (uint32_t) meshlets.size();
+
+	/* Quantization grid, the mesh AABB split into 65535 steps per axis */
+	float lo[3] = {INFINITY, INFINITY, INFINITY};
+	float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+	for (const auto& v : mesh.vertices)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			lo[k] = std::min(lo[k], v.pos[k]);
+			hi[k] = std::max(hi[k], v.pos[k]);
+		}
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		header.pos_offset[k] = lo[k];
+		header.pos_scale[k] = hi[k] - lo[k];
+	}
+
+	std::vector<uint32_t> all(mesh.vertices.size());
+	for (size_t i = 0; i < all.size(); ++i) all[i] = (uint32_t) i;
+	bounding_sphere(mesh, all, header.center, header.radius);
+
+	header.vertex_offset = align_section(sizeof(Mesh_Header));
+	header.index_offset = align_section(header.vertex_offset + header.vertex_count * sizeof(Packed_Vertex));
+	header.meshlet_offset = align_section(header.index_offset + (uint64_t) header.index_count * header.index_size);
+	header.file_size = header.meshlet_offset + header.meshlet_count * sizeof(Meshlet);
+
+	std::vector<char> out(header.file_size, 0);
+	memcpy(out.data(), &header, sizeof(header));
+
+	Packed_Vertex* packed = reinterpret_cast<Packed_Vertex*>(out.data() + header.vertex_offset);
+	for (size_t i = 0; i < mesh.vertices.size(); ++i)
+	{
+		const Vertex& v = mesh.vertices[i];
+		for (int k = 0; k < 3; ++k)
+		{
+			float t = header.pos_scale[k] > 0.0f ? (v.pos[k] - lo[k]) / header.pos_scale[k] : 0.0f;
+			packed[i].position[k] = (uint16_t) std::lround(std::clamp(t, 0.0f, 1.0f) * 65535.0f);
+		}
+		packed[i].position[3] = 0;
+		oct_encode(v.normal, packed[i].normal);
+		packed[i].uv[0] = to_half(v.uv[0]);
+		packed[i].uv[1] = to_half(v.uv[1]);
+	}
+
+	char* index_out = out.data() + header.index_offset;
+	for (size_t i = 0; i < mesh.indices.size(); ++i)
+	{
+		if (header.index_size == 2)
+		{
+			uint16_t index = (uint16_t) mesh.indices[i];
+			memcpy(index_out + i * 2, &index, 2);
+		} else
+		{
+			memcpy(index_out + i * 4, &mesh.indices[i], 4);
+		}
+	}
+
+	memcpy(out.data() + header.meshlet_offset, meshlets.data(), meshlets.size() * sizeof(Meshlet));
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open " + path + " for writing");
+	}
+	file.write(out.data(), out.size());
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		std::cerr << "usage: " << argv[0] << " input.obj output.tmsh" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		Mesh mesh = load_obj(argv[1]);
+		if (mesh.indices.empty())
+		{
+			throw std::runtime_error("No triangles in " + std::string(argv[1]));
+		}
+		float acmr_before = acmr(mesh.indices, mesh.vertices.size(), OVERDRAW_CACHE_SIZE);
+
+		optimize_vertex_cache(mesh);
+		optimize_overdraw(mesh);
+		optimize_vertex_fetch(mesh);
+		std::vector<Meshlet> meshlets = build_meshlets(mesh);
+
+		std::cout << argv[1] << ": " << mesh.vertices.size() << " vertices, "
+			<< mesh.indices.size() / 3 << " triangles, "
+			<< meshlets.size() << " meshlets" << std::endl;
+		std::cout << "  ACMR (fifo " << OVERDRAW_CACHE_SIZE << ") " << acmr_before
+			<< " -> " << acmr(mesh.indices, mesh.vertices.size(), OVERDRAW_CACHE_SIZE) << std::endl;
+
+		write_mesh(mesh, meshlets, argv[2]);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}